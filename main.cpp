@@ -1,61 +1,469 @@
 #include <iostream>
 #include <vector>
 #include <tuple>
-#include <sstream>
 #include <string>
+#include <string_view>
 #include <fstream>
+#include <unordered_map>
+#include <variant>
+#include <span>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <charconv>
+#include <limits>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <optional>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BLACKBOARD_X86_KERNELS 1
+#endif
+
+// Default size of a new board; "new <width> <height>" or --width/--height override it
+const int DEFAULT_BOARD_WIDTH = 80;
+const int DEFAULT_BOARD_HEIGHT = 25;
+// Largest supported width or height, in cells
+const int MAX_BOARD_SIZE = 16384;
+// Minimum time between frames drawn by the render thread (about 60 per second)
+const int DEFAULT_RENDER_INTERVAL_MS = 16;
+// Memory the undo history may use, in MiB; --history-budget overrides it
+const int DEFAULT_HISTORY_BUDGET_MB = 64;
+
+// Byte-fill kernels used to composite spans and to clear the grid. The widest
+// kernel the CPU supports is picked once at startup (CPUID via
+// __builtin_cpu_supports); other platforms use the scalar kernel.
+class FillKernel {
+public:
+    using Function = void (*)(char* dst, size_t count, char value);
+
+    struct Entry {
+        const char* name;
+        Function function;
+    };
+
+    static void fill(char* dst, size_t count, char value) {
+        if (count < 16) {
+            // Short spans (single edge cells etc.) are cheaper without the call
+            for (size_t i = 0; i < count; ++i) dst[i] = value;
+            return;
+        }
+        active().function(dst, count, value);
+    }
+
+    static const char* name() {
+        return active().name;
+    }
+
+    // Every kernel the current CPU can run, scalar first
+    static std::vector<Entry> available() {
+        std::vector<Entry> kernels{{"scalar", fillScalar}};
+#ifdef BLACKBOARD_X86_KERNELS
+        if (__builtin_cpu_supports("sse2")) kernels.push_back({"sse2", fillSSE2});
+        if (__builtin_cpu_supports("avx2")) kernels.push_back({"avx2", fillAVX2});
+#endif
+        return kernels;
+    }
+
+    // Time clearing and span filling on a width x height grid with every kernel
+    static void benchmark(int width, int height, int iterations) {
+        std::vector<char> grid(static_cast<size_t>(width) * height);
+        double megabytes = static_cast<double>(grid.size()) * iterations / (1024.0 * 1024.0);
+
+        for (const Entry& kernel : available()) {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i) {
+                kernel.function(grid.data(), grid.size(), i & 1 ? ' ' : '*');
+                keepAlive(grid.data());
+            }
+            auto middle = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i) {
+                // One span per row, as produced by a board-sized filled rectangle
+                for (int row = 0; row < height; ++row) {
+                    kernel.function(grid.data() + static_cast<size_t>(row) * width, width, i & 1 ? ' ' : '*');
+                }
+                keepAlive(grid.data());
+            }
+            auto end = std::chrono::steady_clock::now();
+
+            double clearSeconds = std::chrono::duration<double>(middle - start).count();
+            double spanSeconds = std::chrono::duration<double>(end - middle).count();
+            std::cout << kernel.name << (kernel.function == active().function ? " (active)" : "")
+                      << ": clear " << megabytes / clearSeconds << " MB/s"
+                      << ", row spans " << megabytes / spanSeconds << " MB/s\n";
+        }
+    }
+
+private:
+    // Fills larger than a typical last-level cache bypass it with streaming stores
+    static const size_t STREAMING_THRESHOLD = 8 << 20;
+
+    // Stop the optimizer from dropping benchmark stores that are never read
+    static void keepAlive(char* data) {
+#ifdef __GNUC__
+        asm volatile("" : : "r"(data) : "memory");
+#else
+        static char* volatile sink;
+        sink = data;
+#endif
+    }
+
+    static const Entry& active() {
+        static const Entry kernel = available().back();
+        return kernel;
+    }
+
+    static void fillScalar(char* dst, size_t count, char value) {
+        std::memset(dst, value, count);
+    }
+
+#ifdef BLACKBOARD_X86_KERNELS
+    static void fillSSE2(char* dst, size_t count, char value) {
+        if (count < 16) {
+            fillScalar(dst, count, value);
+            return;
+        }
+        __m128i pattern = _mm_set1_epi8(value);
+        char* end = dst + count;
+        // Unaligned head and tail stores, aligned stores in between
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), pattern);
+        char* p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(dst) + 16) & ~static_cast<uintptr_t>(15));
+        if (count >= STREAMING_THRESHOLD) {
+            for (; p + 16 <= end; p += 16) _mm_stream_si128(reinterpret_cast<__m128i*>(p), pattern);
+            _mm_sfence();
+        } else {
+            for (; p + 16 <= end; p += 16) _mm_store_si128(reinterpret_cast<__m128i*>(p), pattern);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(end - 16), pattern);
+    }
+
+    __attribute__((target("avx2")))
+    static void fillAVX2(char* dst, size_t count, char value) {
+        if (count < 32) {
+            fillSSE2(dst, count, value);
+            return;
+        }
+        __m256i pattern = _mm256_set1_epi8(value);
+        char* end = dst + count;
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), pattern);
+        char* p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(dst) + 32) & ~static_cast<uintptr_t>(31));
+        if (count >= STREAMING_THRESHOLD) {
+            for (; p + 32 <= end; p += 32) _mm256_stream_si256(reinterpret_cast<__m256i*>(p), pattern);
+            _mm_sfence();
+        } else {
+            for (; p + 32 <= end; p += 32) _mm256_store_si256(reinterpret_cast<__m256i*>(p), pattern);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(end - 32), pattern);
+    }
+#endif
+};
+
+// An inclusive rectangle of cells; empty when x0 > x1 or y0 > y1
+struct Rect {
+    int x0, y0, x1, y1;
+
+    static Rect none() {
+        return {0, 0, -1, -1};
+    }
+
+    // Build a rectangle from wide coordinates, clamped to a safe int range
+    static Rect fromBounds(long long x0, long long y0, long long x1, long long y1) {
+        const long long limit = 1 << 30;
+        auto clamp = [limit](long long v) { return static_cast<int>(std::max(-limit, std::min(limit, v))); };
+        return {clamp(x0), clamp(y0), clamp(x1), clamp(y1)};
+    }
+
+    bool empty() const {
+        return x0 > x1 || y0 > y1;
+    }
+
+    Rect intersect(const Rect& other) const {
+        return {std::max(x0, other.x0), std::max(y0, other.y0), std::min(x1, other.x1), std::min(y1, other.y1)};
+    }
+};
+
+// A cell position on the board
+struct Point {
+    int x, y;
+};
+
+// A window of width x height cells onto framebuffer memory. It is a plain
+// pointer + stride pair, so it is cheap to pass around by value.
+struct FrameView {
+    char* data;    // Cell (0, 0) of the view
+    int width, height;
+    size_t stride; // Bytes between the starts of two consecutive rows
+
+    char* row(int y) const {
+        return data + static_cast<size_t>(y) * stride;
+    }
+
+    void clear(char value) const {
+        if (stride == static_cast<size_t>(width) || height == 1) {
+            // Rows are back to back: one fill covers the whole view
+            FillKernel::fill(data, stride * (height - 1) + width, value);
+            return;
+        }
+        for (int y = 0; y < height; ++y) {
+            FillKernel::fill(row(y), width, value);
+        }
+    }
+};
+
+// Owns the board's cells in one contiguous, cache-line aligned block.
+// Every row starts on a cache line; the padding between rows is never drawn.
+class Framebuffer {
+    static constexpr size_t ALIGNMENT = 64;
+
+    std::unique_ptr<char, decltype(&std::free)> cells;
+    int width, height;
+    size_t stride;
+
+public:
+    Framebuffer(int width, int height)
+    : cells(nullptr, &std::free), width(width), height(height),
+      stride((static_cast<size_t>(width) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT) {
+        size_t bytes = std::max<size_t>(stride * height, ALIGNMENT);
+        cells.reset(static_cast<char*>(std::aligned_alloc(ALIGNMENT, bytes)));
+        if (!cells) throw std::bad_alloc();
+        FillKernel::fill(cells.get(), bytes, ' ');
+    }
+
+    FrameView view() const {
+        return {cells.get(), width, height, stride};
+    }
+
+    int getWidth() const {
+        return width;
+    }
+
+    int getHeight() const {
+        return height;
+    }
+};
+
+// A horizontal run of cells x0..x1 (inclusive) on one row of the board
+struct Span {
+    int row;
+    int x0, x1;
+    char color;
+    uint32_t owner; // ID of the shape that queued it, 0 for the background
+};
+
+// Shapes rasterize themselves into spans clipped to a rectangle of the target
+// view; the board then composites all spans in one pass, in the order the
+// shapes were drawn. With a pick target set, compositing also records the
+// owner of every cell it writes.
+class SpanBuffer {
+    std::vector<Span> spans;
+    FrameView target;
+    Rect clipRect;
+    uint32_t owner = 0;
+    uint32_t* pick = nullptr; // Same width and height as the target, rows back to back
+
+public:
+    explicit SpanBuffer(FrameView target)
+    : target(target), clipRect{0, 0, target.width - 1, target.height - 1} {}
+
+    // Only cells inside the clip rectangle are queued; shapes use it to skip
+    // rows that cannot produce any span
+    const Rect& clip() const {
+        return clipRect;
+    }
+
+    void setClip(const Rect& area) {
+        clipRect = area.intersect({0, 0, target.width - 1, target.height - 1});
+    }
+
+    // Owner recorded for the spans added from now on
+    void setOwner(uint32_t id) {
+        owner = id;
+    }
+
+    // Per-cell owner buffer written alongside the target, or nullptr for none
+    void setPickTarget(uint32_t* cells) {
+        pick = cells;
+    }
+
+    // Queue the cells x0..x1 of a row, clipped to the clip rectangle
+    void add(long long row, long long x0, long long x1, char color) {
+        if (row < clipRect.y0 || row > clipRect.y1) return;
+        if (x0 < clipRect.x0) x0 = clipRect.x0;
+        if (x1 > clipRect.x1) x1 = clipRect.x1;
+        if (x0 > x1) return;
+        spans.push_back({static_cast<int>(row), static_cast<int>(x0), static_cast<int>(x1), color, owner});
+    }
+
+    void clear() {
+        spans.clear();
+    }
+
+    size_t size() const {
+        return spans.size();
+    }
+
+    // Write every queued span into the view with one block fill per span
+    void composite() const {
+        for (const Span& span : spans) {
+            FillKernel::fill(target.row(span.row) + span.x0, span.x1 - span.x0 + 1, span.color);
+        }
+        if (!pick) return;
+        for (const Span& span : spans) {
+            std::fill_n(pick + static_cast<size_t>(span.row) * target.width + span.x0, span.x1 - span.x0 + 1, span.owner);
+        }
+    }
+};
+
+// How a shape is drawn, parsed once from the textual fill type
+enum class FillMode : unsigned char {
+    None,  // Outline only; also used for unrecognised fill types
+    Frame, // Outline only
+    Fill   // Solid interior
+};
+
+// Colours the board can display. Their values are also their palette indices.
+enum class Color : unsigned char {
+    Default, Red, Green, Blue, Yellow
+};
+
+inline FillMode parseFillMode(std::string_view fill) {
+    if (fill == "fill") return FillMode::Fill;
+    if (fill == "frame") return FillMode::Frame;
+    return FillMode::None;
+}
+
+inline const char* fillModeName(FillMode mode) {
+    static const char* names[] = {"none", "frame", "fill"};
+    return names[static_cast<int>(mode)];
+}
+
+// Interned colour names; shapes store a two-byte index into this table. The
+// display colours come first so their index is their Color value. Any other
+// name is kept for printing and saving and is drawn like the default colour.
+// Once the table is full, new names are reported and stored as the default.
+class ColorPalette {
+    // Lets names be looked up by string_view without building a string
+    struct NameHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+    };
+
+    std::vector<std::string> names{"none", "red", "green", "blue", "yellow"};
+    std::unordered_map<std::string, uint16_t, NameHash, std::equal_to<>> indices{
+        {"none", 0}, {"red", 1}, {"green", 2}, {"blue", 3}, {"yellow", 4}};
+    bool overflowReported = false;
+
+public:
+    static ColorPalette& instance() {
+        static ColorPalette palette;
+        return palette;
+    }
+
+    static constexpr size_t CAPACITY = size_t(UINT16_MAX) + 1;
+
+    uint16_t intern(std::string_view name) {
+        auto it = indices.find(name);
+        if (it != indices.end()) return it->second;
+        if (names.size() == CAPACITY) {
+            if (!overflowReported) {
+                std::cout << "Warning: more than " << CAPACITY << " colour names; \"" << name
+                          << "\" and any further new names are stored as \"none\".\n";
+                overflowReported = true;
+            }
+            return 0;
+        }
+        names.emplace_back(name);
+        return indices[names.back()] = static_cast<uint16_t>(names.size() - 1);
+    }
+
+    const std::string& name(uint16_t index) const {
+        return names[index];
+    }
+
+    size_t size() const {
+        return names.size();
+    }
+};
 
-// Define the size of the board
-const int BOARD_WIDTH = 80;
-const int BOARD_HEIGHT = 25;
+// Character stored in the framebuffer for a palette index
+inline char colorToChar(uint16_t color) {
+    static const char chars[] = {'*', 'r', 'g', 'b', 'y'};
+    return color <= static_cast<uint16_t>(Color::Yellow) ? chars[color] : '*';
+}
 
+// Common data of every shape. Shapes are stored by value in a ShapeRecord
+// variant, so there is no virtual interface; each concrete shape provides:
+//   void draw(SpanBuffer& spans) const;
+//   Rect bounds() const;  // Smallest rectangle containing every drawn cell
+//   std::tuple<std::string, int, int, int, int, std::string, std::string> getParameters() const;
+//   bool containsPoint(int px, int py) const;
+//   void move(int newX, int newY);
 class Shape {
 protected:
     int x, y;
     int shapeID;
-    std::string fillType;
-    std::string color;
+    FillMode fillMode;
+    uint16_t colorIndex; // Index into ColorPalette
 
 
 public:
     Shape(int x, int y, const std::string& fillType, const std::string& color )
-    : x(x), y(y), fillType(fillType), color(color), shapeID(-1) {}
-    virtual ~Shape() = default;
-
-    virtual void draw(std::vector<std::vector<char>>& grid) const = 0;
-
-    virtual std::tuple<std::string, int, int, int, int, std::string, std::string> getParameters() const = 0;
-
-    virtual bool containsPoint(int px, int py) const = 0;
+    : x(x), y(y), shapeID(-1), fillMode(parseFillMode(fillType)), colorIndex(ColorPalette::instance().intern(color)) {}
 
-    virtual void move(int newX, int newY) = 0;
+    // From an already parsed fill mode and interned colour
+    Shape(int x, int y, FillMode fillMode, uint16_t colorIndex)
+    : x(x), y(y), shapeID(-1), fillMode(fillMode), colorIndex(colorIndex) {}
 
     void setID(int id) { shapeID = id; }
     int getID() const { return shapeID; }
 
     void setFillType(const std::string& fill) {
-        fillType = fill;
+        fillMode = parseFillMode(fill);
     }
 
-    void setColor(const std::string& newColor) {
-        color = newColor;
+    void setColor(std::string_view newColor) {
+        colorIndex = ColorPalette::instance().intern(newColor);
     }
 
     std::string getColor() const {
-        return color;
+        return ColorPalette::instance().name(colorIndex);
     }
 
     std::string getFill() const {
-        return fillType;
+        return fillModeName(fillMode);
+    }
+
+    FillMode getFillMode() const {
+        return fillMode;
+    }
+
+    uint16_t getColorIndex() const {
+        return colorIndex;
     }
 
     bool isFilled() const {
-        return fillType == "fill";
+        return fillMode == FillMode::Fill;
     }
 
     // Check if the shape should be framed
     bool isFramed() const {
-        return fillType == "frame";
+        return fillMode == FillMode::Frame;
     }
 
     int getX() const {
@@ -78,25 +486,18 @@ public:
     }
 
     std::string getColorCode() const {
-        if (color == "red") return "\033[31m[0m";
-        else if (color == "green") return "\033[32m[0m";
-        else if (color == "blue") return "\033[34m[0m";
-        else if (color == "yellow") return "\033[33m[0m";
-        return "\033[0m";  // Default/reset color
+        if (colorIndex > static_cast<uint16_t>(Color::Yellow)) return "\033[0m";
+        switch (static_cast<Color>(colorIndex)) {
+            case Color::Red: return "\033[31m[0m";
+            case Color::Green: return "\033[32m[0m";
+            case Color::Blue: return "\033[34m[0m";
+            case Color::Yellow: return "\033[33m[0m";
+            default: return "\033[0m";  // Default/reset color
+        }
     }
 
     char getColorChar() const {
-        if (color == "red") {
-            return 'r';
-        } else if (color == "green") {
-            return 'g';
-        } else if (color == "blue") {
-            return 'b';
-        } else if (color == "yellow") {
-            return 'y';
-        } else {
-            return '*';  // Default case
-        }
+        return colorToChar(colorIndex);
     }
 };
 
@@ -107,6 +508,9 @@ public:
     Triangle(int x, int y, int height, const std::string& fill = "none", const std::string& color = "none")
     : Shape(x, y, fill, color), height(height) {}
 
+    Triangle(int x, int y, int height, FillMode fill, uint16_t color)
+    : Shape(x, y, fill, color), height(height) {}
+
     void setHeight(int newHeight) {
         height = newHeight;
     }
@@ -131,99 +535,86 @@ public:
         y = newY;
     }
 
-    void setColor(const std::string& newColor) {
-        color = newColor;
-    }
-
-    void move(int newX, int newY) override {
+    void move(int newX, int newY) {
         x = newX;
         y = newY;
     }
 
-    void draw(std::vector<std::vector<char>>& grid) const override {
-        char colorChar = (color == "red") ? 'r' : (color == "green") ? 'g' : (color == "blue") ? 'b' : (color == "yellow") ? 'y' : '*';
+    void draw(SpanBuffer& spans) const {
+        if (fillMode == FillMode::Fill) drawSpans<FillMode::Fill>(spans);
+        else drawSpans<FillMode::Frame>(spans);
+    }
 
+    // Rasterizer specialized per fill mode, so the row loop has no mode checks
+    template <FillMode Mode>
+    void drawSpans(SpanBuffer& spans) const {
         if (height <= 0) return; // Ensure the triangle height is positive and sensible
-        // char colorSymbol = color.empty() ? '*' : color[0];
-        for (int i = 0; i < height; ++i) {
+
+        char colorChar = getColorChar();
+
+        // Only rows inside the clip rectangle produce spans
+        int first = std::max(0, spans.clip().y0 - y);
+        int last = std::min(height - 1, spans.clip().y1 - y);
+        for (int i = first; i <= last; ++i) {
             int leftMost = x - i; // Calculate the starting position
             int rightMost = x + i; // Calculate the ending position
             int posY = y + i; // Calculate the vertical position
-            // Draw only the edges/border of the triangle
-
-            if (posY < BOARD_HEIGHT) {
-                if (fillType == "fill") {
-                    // If the shape should be filled, fill between leftMost and rightMost
-                    for (int j = leftMost; j <= rightMost; ++j) {
-                        if (j >= 0 && j < BOARD_WIDTH) {
-                            grid[posY][j] = colorChar; // Fill the triangle with the color symbol
-                        }
-                    }
-                }
 
-                if (fillType == "frame" || fillType == "none") {
-                    if (leftMost >= 0 && leftMost < BOARD_WIDTH) // Check bounds for left most position
-                        grid[posY][leftMost] = colorChar;
-                    // grid[posY][leftMost] = '*';
-                    if (rightMost >= 0 && rightMost < BOARD_WIDTH && leftMost != rightMost)
-                        grid[posY][rightMost] = colorChar;
-                    // grid[posY][rightMost] = '*';
-                }
+            if (Mode == FillMode::Fill || i == height - 1) {
+                // The base is always solid; filled triangles are solid on every row
+                spans.add(posY, leftMost, rightMost, colorChar);
+            } else {
+                // Draw only the edges/border of the triangle
+                spans.add(posY, leftMost, leftMost, colorChar);
+                if (leftMost != rightMost)
+                    spans.add(posY, rightMost, rightMost, colorChar);
             }
         }
+    }
 
-        // Draw the base of the triangle separately
-        for (int j = 0; j < 2 * height - 1; ++j) {
-            int baseX = x - height + 1 + j;
-            int baseY = y + height - 1;
-            if (baseX >= 0 && baseX < BOARD_WIDTH && baseY < BOARD_HEIGHT) // Check bounds for each position on the base
-                // grid[baseY][baseX] = '*';
-                grid[baseY][baseX] = colorChar;
-        }
+    Rect bounds() const {
+        if (height <= 0) return Rect::none();
+        return Rect::fromBounds(static_cast<long long>(x) - height + 1, y,
+                                static_cast<long long>(x) + height - 1, static_cast<long long>(y) + height - 1);
     }
 
-    bool containsPoint(int px, int py) const override {
-        // Check if the point is on the left or right edge
-        for (int i = 0; i < height; ++i) {
-            int leftMost = x - i;
-            int rightMost = x + i;
-            int posY = y + i;
-            if (posY == py) {
-                if (px == leftMost || px == rightMost) {
-                    return true;
-                }
-            }
-        }
-        // Check the base
-        int baseY = y + height - 1;
-        if (py == baseY) {
-            if (px >= (x - height + 1) && px <= (x + height - 1)) {
-                return true;
-            }
-        }
-        return false;
+    // Whether drawSpans covers the cell, in O(1): row i spans x - i .. x + i,
+    // solid for filled triangles and the base, only the two edges otherwise
+    bool containsPoint(int px, int py) const {
+        long long i = static_cast<long long>(py) - y;
+        if (i < 0 || i >= height) return false;
+        long long dx = std::abs(static_cast<long long>(px) - x);
+        if (fillMode == FillMode::Fill || i == height - 1) return dx <= i;
+        return dx == i;
     }
 
-    std::tuple<std::string, int, int, int, int, std::string, std::string> getParameters() const override {
-        return std::make_tuple("Triangle", x, y, height, 0, fillType, color);
+    std::tuple<std::string, int, int, int, int, std::string, std::string> getParameters() const {
+        return std::make_tuple("Triangle", x, y, height, 0, getFill(), getColor());
     }
 };
 
 class Circle : public Shape {
     int radius;
 
+    // Largest s with s * s <= value, for value >= 0
+    static long long floorSqrt(long long value) {
+        long long root = static_cast<long long>(std::sqrt(static_cast<double>(value)));
+        while (root * root > value) --root;
+        while ((root + 1) * (root + 1) <= value) ++root;
+        return root;
+    }
+
 public:
     Circle(int x, int y, int radius, const std::string& fill = "none", const std::string& color = "none")
     : Shape(x, y, fill, color), radius(radius) {}
 
+    Circle(int x, int y, int radius, FillMode fill, uint16_t color)
+    : Shape(x, y, fill, color), radius(radius) {}
+
     void setRadius(int newRadius) {
         radius = newRadius;
     }
 
-    void setColor(const std::string& newColor) {
-        color = newColor;
-    }
-
     int getX() const {
         return x;
     }
@@ -243,50 +634,79 @@ public:
         y = newY;
     }
 
-    void move(int newX, int newY) override {
+    void move(int newX, int newY) {
         x = newX;
         y = newY;
     }
 
-    void draw(std::vector<std::vector<char>>& grid) const override {
+    void draw(SpanBuffer& spans) const {
+        if (fillMode == FillMode::Fill) drawSpans<FillMode::Fill>(spans);
+        else drawSpans<FillMode::Frame>(spans);
+    }
+
+    // Rasterizer specialized per fill mode, so the row loop has no mode checks
+    template <FillMode Mode>
+    void drawSpans(SpanBuffer& spans) const {
         if (radius <= 0) return;
 
         char colorChar = getColorChar();
 
-        int r2 = radius * radius;  // Precompute radius squared to compare distances
-        for (int i = 0; i < BOARD_HEIGHT; ++i) {
-            for (int j = 0; j < BOARD_WIDTH; ++j) {
-                // Calculate the squared distance from the point (i, j) to the center (x, y)
-                int dx = j - x;
-                int dy = i - y;
-                int distSquared = dx * dx + dy * dy;
-
-                if (fillType == "fill") {
-                    // Fill the entire circle area
-                    if (distSquared <= r2) {
-                        grid[i][j] = colorChar;
-                    }
-                } else if (fillType == "frame" || fillType == "none") {
-                    // Draw the border (circle frame)
-                    if (distSquared >= (r2 - radius) && distSquared <= (r2 + radius)) {
-                        grid[i][j] = colorChar;
-                    }
-                }
+        // A cell (dx, dy) belongs to the circle when inner <= dx*dx + dy*dy <= outer.
+        // Filled circles have no inner bound, frames keep the ring of width ~1.
+        constexpr bool filled = Mode == FillMode::Fill;
+        long long r2 = static_cast<long long>(radius) * radius;
+        long long outer = filled ? r2 : r2 + radius;
+        long long inner = filled ? 0 : r2 - radius;
+
+        // Only the rows of the bounding box inside the clip rectangle are visited;
+        // each row's span boundaries come straight from an integer square root.
+        long long firstRow = std::max<long long>(static_cast<long long>(y) - radius, spans.clip().y0);
+        long long lastRow = std::min<long long>(static_cast<long long>(y) + radius, spans.clip().y1);
+        for (long long row = firstRow; row <= lastRow; ++row) {
+            long long dy = row - y;
+            long long outerLimit = outer - dy * dy;
+            if (outerLimit < 0) continue;
+            long long outerX = floorSqrt(outerLimit); // largest dx with dx*dx <= outerLimit
+
+            if constexpr (filled) {
+                spans.add(row, x - outerX, x + outerX, colorChar);
+                continue;
+            }
+
+            long long innerLimit = inner - dy * dy;
+            long long innerX = innerLimit <= 0 ? 0 : floorSqrt(innerLimit - 1) + 1; // smallest dx with dx*dx >= innerLimit
+            if (outerX < innerX) continue; // No cell of this row is on the ring
+
+            if (innerX == 0) {
+                spans.add(row, x - outerX, x + outerX, colorChar);
+            } else {
+                // Frame rows are split into a left and a right arc
+                spans.add(row, x - outerX, x - innerX, colorChar);
+                spans.add(row, x + innerX, x + outerX, colorChar);
             }
         }
     }
 
-    bool containsPoint(int px, int py) const override {
-        int dx = px - x;
-        int dy = py - y;
-        int distSquared = dx * dx + dy * dy;
-        int r2 = radius * radius;
-        return (distSquared >= (r2 - radius) && distSquared <= (r2 + radius));
+    Rect bounds() const {
+        if (radius <= 0) return Rect::none();
+        return Rect::fromBounds(static_cast<long long>(x) - radius, static_cast<long long>(y) - radius,
+                                static_cast<long long>(x) + radius, static_cast<long long>(y) + radius);
+    }
+
+    // Whether drawSpans covers the cell: the same distance bounds, without the square roots
+    bool containsPoint(int px, int py) const {
+        if (radius <= 0) return false;
+        long long dx = static_cast<long long>(px) - x;
+        long long dy = static_cast<long long>(py) - y;
+        long long distSquared = dx * dx + dy * dy;
+        long long r2 = static_cast<long long>(radius) * radius;
+        if (fillMode == FillMode::Fill) return distSquared <= r2;
+        return distSquared >= r2 - radius && distSquared <= r2 + radius;
     }
 
     // Return the shape's parameters as a tuple
-    std::tuple<std::string, int, int, int, int, std::string, std::string> getParameters() const override {
-        return std::make_tuple("Circle", x, y, radius, 0, fillType, color);
+    std::tuple<std::string, int, int, int, int, std::string, std::string> getParameters() const {
+        return std::make_tuple("Circle", x, y, radius, 0, getFill(), getColor());
     }
 };
 
@@ -298,15 +718,14 @@ public:
     Rectangle(int x, int y, int width, int height, const std::string& fill = "none", const std::string& color = "none")
     : Shape(x, y, fill, color), width(width), height(height) {}
 
+    Rectangle(int x, int y, int width, int height, FillMode fill, uint16_t color)
+    : Shape(x, y, fill, color), width(width), height(height) {}
+
     void setDimensions(int newWidth, int newHeight) {
         width = newWidth;
         height = newHeight;
     }
 
-    void setColor(const std::string& newColor) {
-        color = newColor;
-    }
-
     int getX() const {
         return x;
     }
@@ -326,83 +745,120 @@ public:
         y = newY;
     }
 
-    void move(int newX, int newY) override {
+    void move(int newX, int newY) {
         x = newX;
         y = newY;
     }
 
-    void draw(std::vector<std::vector<char>>& grid) const override {
+    void draw(SpanBuffer& spans) const {
+        if (fillMode == FillMode::Fill) drawSpans<FillMode::Fill>(spans);
+        else drawSpans<FillMode::Frame>(spans);
+    }
+
+    // Rasterizer specialized per fill mode, so the row loop has no mode checks
+    template <FillMode Mode>
+    void drawSpans(SpanBuffer& spans) const {
         if (width <= 0 || height <= 0) return;
 
         char colorChar = getColorChar();
 
-        for (int i = 0; i < height; ++i) {
-            for (int j = 0; j < width; ++j) {
-                int gridX = x + j; // Calculate grid x position
-                int gridY = y + i; // Calculate grid y position
-
-                if (fillType == "fill"){ }
-                if (gridY < BOARD_HEIGHT && gridX < BOARD_WIDTH) {
-                    grid[gridY][gridX] = colorChar; // Fill the rectangle with color
-                }
-                else if (fillType == "frame" || fillType == "none") {
-                    // Draw the top and bottom borders
-                    if (i == 0 || i == height - 1) {
-                        if (gridY < BOARD_HEIGHT && gridX < BOARD_WIDTH) {
-                            grid[gridY][gridX] = colorChar; // Draw top and bottom edges
-                        }
-                    }
+        int first = std::max(0, spans.clip().y0 - y);
+        int last = std::min(height - 1, spans.clip().y1 - y);
+        for (int i = first; i <= last; ++i) {
+            int gridY = y + i; // Calculate grid y position
 
-                    // Draw the left and right borders
-                    else if (j == 0 || j == width - 1) {
-                        if (gridY < BOARD_HEIGHT && gridX < BOARD_WIDTH) {
-                            grid[gridY][gridX] = colorChar; // Draw left and right edges
-                        }
-                    }
-                }
+            if (Mode == FillMode::Fill || i == 0 || i == height - 1) {
+                // Filled rows and the top and bottom borders
+                spans.add(gridY, x, x + width - 1, colorChar);
+            } else {
+                // Draw the left and right borders
+                spans.add(gridY, x, x, colorChar);
+                spans.add(gridY, x + width - 1, x + width - 1, colorChar);
             }
         }
     }
 
-    bool containsPoint(int px, int py) const override {
-        // Check if the point is on the top or bottom edge
-        if (py == y || py == y + height - 1) {
-            if (px >= x && px < x + width) {
-                return true;
-            }
-        }
-        // Check the left and right edges
-        if ((px == x || px == x + width - 1) && py >= y && py < y + height) {
-            return true;
-        }
-        return false;
+    Rect bounds() const {
+        if (width <= 0 || height <= 0) return Rect::none();
+        return Rect::fromBounds(x, y, static_cast<long long>(x) + width - 1, static_cast<long long>(y) + height - 1);
+    }
+
+    // Whether drawSpans covers the cell, in O(1)
+    bool containsPoint(int px, int py) const {
+        long long i = static_cast<long long>(py) - y;
+        long long j = static_cast<long long>(px) - x;
+        if (width <= 0 || i < 0 || i >= height || j < 0 || j >= width) return false;
+        // Filled rectangles and the top and bottom borders are solid rows
+        if (fillMode == FillMode::Fill || i == 0 || i == height - 1) return true;
+        return j == 0 || j == width - 1;
     }
 
     // Method to return the shape's parameters
-    std::tuple<std::string, int, int, int, int, std::string, std::string> getParameters() const override {
-        return std::make_tuple("Rectangle", x, y, width, height, fillType, color);
+    std::tuple<std::string, int, int, int, int, std::string, std::string> getParameters() const {
+        return std::make_tuple("Rectangle", x, y, width, height, getFill(), getColor());
     }
 };
 
 class Line : public Shape {
 private:
-    int x1, y1, x2, y2;
+    int x2, y2; // The start point is the shape's (x, y)
+
+    // Cells [left, right] that Bresenham's algorithm visits on the given row, computed in O(1) from the step conditions
+    // instead of walking the line. Returns false if the row is not on the line.
+    bool rowSpan(long long row, long long& left, long long& right) const {
+        long long dx = std::abs(static_cast<long long>(x2) - x);
+        long long dy = std::abs(static_cast<long long>(y2) - y);
+        long long sx = (x < x2) ? 1 : -1;
+        long long m = (y < y2) ? row - y : y - row; // Steps taken in y to reach the row
+        if (m < 0 || m > dy) return false;
+
+        // After n x-steps and m y-steps the error term is dx(m+1) - dy(n+1), so
+        // the line steps in y once n >= L(m) and in x once m >= M(n). With
+        // distances of up to 2^32 - 1 the products need 128 bits; the
+        // quotients fit in a long long again.
+        auto L = [&](long long m) { return static_cast<long long>(static_cast<__int128>(dx) * (2 * m + 1) / (2 * dy)); };
+        auto M = [&](long long n) { return static_cast<long long>(static_cast<__int128>(dy) * (2 * n + 1) / (2 * dx)); };
+
+        long long first, last;
+        if (dy == 0) {
+            first = 0;
+            last = dx;
+        } else if (dx == 0) {
+            first = last = 0;
+        } else if (dx >= dy) {
+            // Shallow line: a run of x-steps per row
+            first = 0;
+            if (m > 0) {
+                long long previous = L(m - 1);
+                first = previous + (m - 1 >= M(previous) ? 1 : 0);
+            }
+            last = m == dy ? dx : L(m);
+        } else {
+            // Steep line: one cell per row, in the first column whose run reaches it
+            __int128 numerator = static_cast<__int128>(2 * dx) * m - dy;
+            first = numerator <= 0 ? 0 : static_cast<long long>((numerator + 2 * dy - 1) / (2 * dy));
+            first = last = std::min(first, dx);
+        }
+
+        left = x + sx * (sx > 0 ? first : last);
+        right = x + sx * (sx > 0 ? last : first);
+        return true;
+    }
 
 public:
     Line(int startX, int startY, int endX, int endY, const std::string& fill = "none", const std::string& color = "none")
-    : Shape(startX, startY, fill, color), x1(startX), y1(startY), x2(endX), y2(endY) {}
+    : Shape(startX, startY, fill, color), x2(endX), y2(endY) {}
+
+    Line(int startX, int startY, int endX, int endY, FillMode fill, uint16_t color)
+    : Shape(startX, startY, fill, color), x2(endX), y2(endY) {}
 
     void setDimensions(int newX1, int newY1, int newX2, int newY2) {
-        x1 = newX1;
-        y1 = newY1;
+        x = newX1;
+        y = newY1;
         x2 = newX2;
         y2 = newY2;
     }
 
-    void setColor(const std::string& newColor) {
-        color = newColor;
-    }
-
     int getX() const {
         return x;
     }
@@ -422,194 +878,1914 @@ public:
         y = newY;
     }
 
-    void move(int newX, int newY) override {
+    void move(int newX, int newY) {
+        // Translate both endpoints so the line keeps its length and direction
+        x2 += newX - x;
+        y2 += newY - y;
         x = newX;
         y = newY;
     }
 
-    void draw(std::vector<std::vector<char>>& grid) const override {
+    void draw(SpanBuffer& spans) const {
         char colorChar = getColorChar();
 
-        int dx = abs(x2 - x1);
-        int dy = abs(y2 - y1);
-        int sx = (x1 < x2) ? 1 : -1; // Step in x
-        int sy = (y1 < y2) ? 1 : -1; // Step in y
-        int err = dx - dy;
-
-        int x = x1;
-        int y = y1;
-
-        while (true) {
-            // Ensure the point is within grid bounds
-            if (x >= 0 && x < BOARD_WIDTH && y >= 0 && y < BOARD_HEIGHT) {
-                grid[y][x] = colorChar;
-            }
-
-            // Check if we reached the endpoint
-            if (x == x2 && y == y2) break;
-
-            int e2 = 2 * err;
-
-            // Move horizontally or vertically based on error margin
-            if (e2 > -dy) {
-                err -= dy;
-                x += sx; // Move in x direction
-            }
-            if (e2 < dx) {
-                err += dx;
-                y += sy; // Move in y direction
+        int firstRow = std::max(std::min(y, y2), spans.clip().y0);
+        int lastRow = std::min(std::max(y, y2), spans.clip().y1);
+        for (int row = firstRow; row <= lastRow; ++row) {
+            long long left, right;
+            if (rowSpan(row, left, right)) {
+                spans.add(row, left, right, colorChar);
             }
         }
     }
 
-    bool containsPoint(int px, int py) const override {
-        // Implement Bresenham's line algorithm to check if the point is on the line
-        int dx = abs(x2 - x1);
-        int dy = abs(y2 - y1);
-        int sx = (x1 < x2) ? 1 : -1;
-        int sy = (y1 < y2) ? 1 : -1;
-        int err = dx - dy;
-
-        int x = x1;
-        int y = y1;
-
-        while (true) {
-            if (x == px && y == py) {
-                return true;
-            }
-
-            if (x == x2 && y == y2) {
-                break;
-            }
-
-            int e2 = 2 * err;
-            if (e2 > -dy) {
-                err -= dy;
-                x += sx;
-            }
-            if (e2 < dx) {
-                err += dx;
-                y += sy;
-            }
-        }
+    Rect bounds() const {
+        return {std::min(x, x2), std::min(y, y2), std::max(x, x2), std::max(y, y2)};
+    }
 
-        return false;
+    // Whether the line covers the cell, from the row's span in O(1)
+    // however long the line is
+    bool containsPoint(int px, int py) const {
+        long long left, right;
+        return rowSpan(py, left, right) && px >= left && px <= right;
     }
 
-    std::tuple<std::string, int, int, int, int, std::string, std::string> getParameters() const override {
-        return std::make_tuple("Line", x1, y1, x2, y2, fillType, color);
+    std::tuple<std::string, int, int, int, int, std::string, std::string> getParameters() const {
+        return std::make_tuple("Line", x, y, x2, y2, getFill(), getColor());
     }
 };
 
-struct Board {
-private:
-    std::vector<std::vector<char>> grid;
-    std::vector<std::tuple<int, std::string, int, int, int, int, std::string, std::string>> shapesParams; // Store shape parameters
-    std::vector<std::shared_ptr<Shape>> shapes;
-    int currentShapeID = 1;
-    int selectedShapeID = -1;
+// Every shape on a board is stored by value in one contiguous vector of
+// these, and dispatched with std::visit instead of virtual calls
+using ShapeRecord = std::variant<Circle, Rectangle, Triangle, Line>;
+
+// Shape records stay within half a cache line
+static_assert(sizeof(ShapeRecord) <= 32, "shape records must fit in 32 bytes");
+
+// The data common to every kind of shape
+inline Shape& shapeOf(ShapeRecord& record) {
+    return std::visit([](Shape& shape) -> Shape& { return shape; }, record);
+}
+
+inline const Shape& shapeOf(const ShapeRecord& record) {
+    return std::visit([](const Shape& shape) -> const Shape& { return shape; }, record);
+}
 
+// Binary scene files. Layout, all integers little-endian:
+//
+//   header   magic "BLKBOARD", u32 version, u32 record size, u64 shape count,
+//            u64 string table size, u64 checksum of the records, continued
+//            over the string table
+//   records  one fixed-size record per shape, back to front:
+//            u8 kind, u8 fill mode, u16 colour,
+//            i32 x, i32 y, i32 param1, i32 param2 (as in the text format)
+//   strings  the colour names the records index, each NUL-terminated
+//
+// Files are loaded through mmap and turned into shapes straight from the
+// mapped records.
+class SceneFormat {
 public:
-    Board() : grid(BOARD_HEIGHT, std::vector<char>(BOARD_WIDTH, ' ')) {}
+    static constexpr char MAGIC[8] = {'B', 'L', 'K', 'B', 'O', 'A', 'R', 'D'};
+    static const uint32_t VERSION = 1;
+    static const size_t HEADER_SIZE = 40;
+    static const size_t RECORD_SIZE = 20;
 
-    bool isOccupied(int x, int y) const {
-        for (const auto& shape : shapes) {
-            if (shape->containsPoint(x, y)) {
-                return true; // If any shape contains the point, it's occupied
-            }
-        }
-        return false; // No shape contains the point
-    }
-    void addCircle(int x, int y, int radius, const std::string& fill , const std::string& color ) {
-        auto circle = std::make_shared<Circle>(x, y, radius, fill, color);
-        circle->setID(currentShapeID++);
-        shapes.push_back(circle);
+    // Record kinds, in the order of the ShapeRecord alternatives
+    enum Kind : uint8_t { CIRCLE, RECTANGLE, TRIANGLE, LINE };
 
-        shapesParams.push_back(std::make_tuple(circle->getID(), "Circle", x, y, radius, 0, fill, color));
+    // The kind of a type name of the text format
+    static bool kindFromName(std::string_view name, Kind& kind) {
+        if (name == "Circle") kind = CIRCLE;
+        else if (name == "Rectangle") kind = RECTANGLE;
+        else if (name == "Triangle") kind = TRIANGLE;
+        else if (name == "Line") kind = LINE;
+        else return false;
+        return true;
     }
 
-    // Add a Rectangle to the board
-    void addRectangle(int x, int y, int width, int height, const std::string& fill , const std::string& color ) {
-        auto rectangle = std::make_shared<Rectangle>(x, y, width, height, fill, color);
-        rectangle->setID(currentShapeID++);
-        shapes.push_back(rectangle);
+    static uint16_t load16(const uint8_t* in) {
+        return static_cast<uint16_t>(in[0] | in[1] << 8);
+    }
 
-        shapesParams.push_back(std::make_tuple(rectangle->getID(), "Rectangle", x, y, width, height, fill, color));
+    static uint32_t load32(const uint8_t* in) {
+        return in[0] | in[1] << 8 | in[2] << 16 | static_cast<uint32_t>(in[3]) << 24;
     }
 
-    // Add a Triangle to the board
-    void addTriangle(int x, int y, int height, const std::string& fill , const std::string& color ) {
-        auto triangle = std::make_shared<Triangle>(x, y, height, fill, color);
-        triangle->setID(currentShapeID++);
-        shapes.push_back(triangle);
+    static uint64_t load64(const uint8_t* in) {
+        return load32(in) | static_cast<uint64_t>(load32(in + 4)) << 32;
+    }
 
-        shapesParams.push_back(std::make_tuple(triangle->getID(), "Triangle", x, y, height, 0, fill, color));
+    static void store16(uint8_t* out, uint16_t value) {
+        out[0] = static_cast<uint8_t>(value);
+        out[1] = static_cast<uint8_t>(value >> 8);
     }
 
-    // Add a Line to the board
-    void addLine(int x1, int y1, int x2, int y2, const std::string& fill , const std::string& color ) {
-        auto line = std::make_shared<Line>(x1, y1, x2, y2, fill, color);
-        line->setID(currentShapeID++);
-        shapes.push_back(line);
+    static void store32(uint8_t* out, uint32_t value) {
+        for (int i = 0; i < 4; ++i) out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
 
-        shapesParams.push_back(std::make_tuple(line->getID(), "Line", x1, y1, x2, y2, fill, color));
+    static void store64(uint8_t* out, uint64_t value) {
+        store32(out, static_cast<uint32_t>(value));
+        store32(out + 4, static_cast<uint32_t>(value >> 32));
     }
 
-    // Method to draw all shapes on the board
-    void drawBoard() {
-        // Clear the grid before drawing
-        for (auto& row : grid) {
-            std::fill(row.begin(), row.end(), ' ');
-        }
-
-        std::cout << std::string(BOARD_WIDTH + 2, '-') << std::endl;
-
-        // Draw each shape on the grid
-        for (const auto& shape : shapes) {
-            shape->draw(grid);
-        }
-
-        // Print the grid to the console
-        for (const auto& row : grid) {
-            std::cout << "|";
-            for (char cell : row) {
-                if (cell == 'r') {
-                    std::cout << "\033[31m" << 'r' << "\033[0m";  // Red
-                } else if (cell == 'g') {
-                    std::cout << "\033[32m" << 'g' << "\033[0m";  // Green
-                } else if (cell == 'b') {
-                    std::cout << "\033[34m" << 'b' << "\033[0m";  // Blue
-                } else if (cell == 'y') {
-                    std::cout << "\033[33m" << 'y' << "\033[0m";  // Yellow
-                } else {
-                    std::cout << cell;  // Default (e.g., '*')
-                }  // Print each cell, which may contain color codes
-            }
-            std::cout << "|";
-            std::cout << '\n';
+    // Word-at-a-time hash. Feeding data in pieces gives the same result as
+    // one call as long as every piece but the last is a multiple of 8 bytes.
+    static uint64_t checksum(const uint8_t* data, size_t size, uint64_t hash = 0x9E3779B97F4A7C15ull) {
+        const uint64_t k1 = 0x87C37B91114253D5ull, k2 = 0x4CF5AD432745937Full;
+        size_t words = size / 8;
+        for (size_t i = 0; i < words; ++i) {
+            uint64_t word = load64(data + 8 * i) * k1;
+            hash = ((hash ^ word) << 31 | (hash ^ word) >> 33) * k2;
         }
-        std::cout << std::string(BOARD_WIDTH + 2, '-') << std::endl;
+        for (size_t i = words * 8; i < size; ++i) {
+            hash = (hash ^ data[i]) * k1;
+        }
+        return hash;
     }
+};
 
-    void clear() {
-        shapes.clear();
-        shapesParams.clear();
-        selectedShapeID = -1;
-        for (auto& row : grid) {
-            std::fill(row.begin(), row.end(), ' '); // Fill each row with empty spaces
+static_assert(std::is_same_v<std::variant_alternative_t<SceneFormat::CIRCLE, ShapeRecord>, Circle> &&
+              std::is_same_v<std::variant_alternative_t<SceneFormat::RECTANGLE, ShapeRecord>, Rectangle> &&
+              std::is_same_v<std::variant_alternative_t<SceneFormat::TRIANGLE, ShapeRecord>, Triangle> &&
+              std::is_same_v<std::variant_alternative_t<SceneFormat::LINE, ShapeRecord>, Line>,
+              "scene record kinds must match the ShapeRecord alternatives");
+
+// write(2) all of data to fd, retrying short and interrupted writes.
+// Returns false on any other error, with errno set.
+inline bool writeFully(int fd, const void* data, size_t size) {
+    const char* next = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t written = ::write(fd, next, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
         }
+        next += written;
+        size -= static_cast<size_t>(written);
     }
+    return true;
+}
+
+// A whole file mapped read-only into memory, unmapped on destruction
+class MappedFile {
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
 
-    void undoClear() {
-        for (auto& row : grid) {
-            std::fill(row.begin(), row.end(), ' '); // Fill each row with empty spaces
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (bytes) munmap(const_cast<uint8_t*>(bytes), length);
+    }
+
+    // Map the file; returns false if it cannot be opened or mapped (or is empty)
+    bool open(const std::string& filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+            ::close(fd);
+            return false;
         }
+        void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // The mapping keeps the file alive
+        if (mapped == MAP_FAILED) return false;
+        madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+        bytes = static_cast<const uint8_t*>(mapped);
+        length = static_cast<size_t>(info.st_size);
+        return true;
     }
 
-    void showShapesList() {
-        for (const auto& shape : shapes) {
-            auto [type, x, y, param1, param2, fillType, color] = shape->getParameters();
-            std::cout << "ID: " << shape->getID() << " | Type: " << type
+    const uint8_t* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+// Append-only log of the mutating commands applied to a board. The file
+// starts with the magic "BLKJRNL1" and then holds records, all integers
+// little-endian:
+//
+//   u8 op, u16 payload size, payload, u32 checksum of op + size + payload
+//
+// Each record is written to the file as soon as it is appended, so a crashed
+// process loses nothing. Records are fsynced in groups, either after
+// GROUP_COMMIT_RECORDS records or once the oldest unsynced record is
+// GROUP_COMMIT_INTERVAL old, and on commit(), which the command loop also
+// calls before it waits for input. A torn record at the end of the file,
+// from a crash mid-write, is dropped on replay. A write or sync that fails
+// is reported by append() or commit() returning false, with the partial
+// record cut off again; the file must not be appended to after that.
+class Journal {
+public:
+    enum Op : uint8_t {
+        ADD = 1,  // i32 id, u8 kind, u8 fill, i32 x, y, param1, param2, colour name
+        MOVE,     // i32 id, i32 x, i32 y
+        PAINT,    // i32 id, colour name
+        EDIT,     // i32 id, i32 size1, i32 size2
+        REMOVE,   // i32 id
+        CLEAR,    // nothing
+        RESIZE,   // i32 width, i32 height
+        NEXT_ID,  // i32 id given to the next new shape, u32 next draw order
+        PLACE     // As ADD with a u32 draw order before the colour name; replaces any shape with the id
+    };
+
+    // Builds the payload of a record
+    class Payload {
+        std::vector<uint8_t> bytes;
+
+    public:
+        Payload& int32(int value) {
+            uint8_t out[4];
+            SceneFormat::store32(out, static_cast<uint32_t>(value));
+            bytes.insert(bytes.end(), out, out + 4);
+            return *this;
+        }
+
+        Payload& byte(uint8_t value) {
+            bytes.push_back(value);
+            return *this;
+        }
+
+        // Text fills the rest of the payload, cut to the largest payload size
+        Payload& text(std::string_view value) {
+            size_t room = bytes.size() < UINT16_MAX ? UINT16_MAX - bytes.size() : 0;
+            bytes.insert(bytes.end(), value.begin(), value.begin() + std::min(room, value.size()));
+            return *this;
+        }
+
+        void clear() {
+            bytes.clear();
+        }
+
+        const std::vector<uint8_t>& data() const {
+            return bytes;
+        }
+    };
+
+    // Reads the payload of a record back
+    class Reader {
+        const uint8_t* next;
+        const uint8_t* end;
+
+    public:
+        Reader(const uint8_t* data, size_t size) : next(data), end(data + size) {}
+
+        bool int32(int& value) {
+            if (end - next < 4) return false;
+            value = static_cast<int32_t>(SceneFormat::load32(next));
+            next += 4;
+            return true;
+        }
+
+        bool byte(uint8_t& value) {
+            if (next == end) return false;
+            value = *next++;
+            return true;
+        }
+
+        // The rest of the payload
+        std::string text() {
+            std::string value(reinterpret_cast<const char*>(next), end - next);
+            next = end;
+            return value;
+        }
+    };
+
+private:
+    static constexpr char MAGIC[8] = {'B', 'L', 'K', 'J', 'R', 'N', 'L', '1'};
+    static const size_t RECORD_OVERHEAD = 7;
+    static const size_t GROUP_COMMIT_RECORDS = 256;
+    static constexpr std::chrono::milliseconds GROUP_COMMIT_INTERVAL{50};
+
+    std::string path;
+    int fd = -1;
+    size_t end = 0; // Offset just past the last whole record
+    size_t unsynced = 0;
+    std::chrono::steady_clock::time_point oldestUnsynced;
+    size_t records = 0; // Since the file was last rewritten
+    std::vector<uint8_t> record; // Reused by append
+
+public:
+    // Append one encoded record to out
+    static void encode(std::vector<uint8_t>& out, Op op, const Payload& payload) {
+        size_t start = out.size();
+        const std::vector<uint8_t>& data = payload.data();
+        out.push_back(op);
+        out.push_back(static_cast<uint8_t>(data.size()));
+        out.push_back(static_cast<uint8_t>(data.size() >> 8));
+        out.insert(out.end(), data.begin(), data.end());
+        uint32_t checksum = static_cast<uint32_t>(SceneFormat::checksum(out.data() + start, out.size() - start));
+        out.resize(out.size() + 4);
+        SceneFormat::store32(out.data() + out.size() - 4, checksum);
+    }
+
+    explicit Journal(std::string path) : path(std::move(path)) {}
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    ~Journal() {
+        if (fd < 0) return;
+        commit();
+        ::close(fd);
+    }
+
+    const std::string& getPath() const {
+        return path;
+    }
+
+    // Records appended since the file was last rewritten
+    size_t size() const {
+        return records;
+    }
+
+    // Call apply(op, reader) for every intact record of an existing journal,
+    // drop a torn tail, and open it for appending; a missing journal is
+    // created empty. Returns the number of records replayed, or -1 if the
+    // file cannot be used.
+    template <typename Apply>
+    long long open(Apply apply) {
+        long long replayed = 0;
+        size_t good = sizeof(MAGIC);
+        {
+            MappedFile mapped;
+            if (mapped.open(path)) {
+                const uint8_t* data = mapped.data();
+                size_t size = mapped.size();
+                if (size < sizeof(MAGIC) || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0) return -1;
+                while (size - good >= RECORD_OVERHEAD) {
+                    const uint8_t* record = data + good;
+                    size_t length = record[1] | record[2] << 8;
+                    if (size - good - RECORD_OVERHEAD < length) break;
+                    uint32_t checksum = static_cast<uint32_t>(SceneFormat::checksum(record, 3 + length));
+                    if (SceneFormat::load32(record + 3 + length) != checksum) break;
+                    Reader reader(record + 3, length);
+                    apply(static_cast<Op>(record[0]), reader);
+                    good += RECORD_OVERHEAD + length;
+                    ++replayed;
+                }
+            }
+        }
+
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return -1;
+        struct stat info;
+        if (fstat(fd, &info) != 0) return -1;
+        if (info.st_size == 0) {
+            if (!writeFully(fd, MAGIC, sizeof(MAGIC))) return -1;
+        } else if (static_cast<size_t>(info.st_size) != good && ftruncate(fd, good) != 0) {
+            return -1; // Could not drop the torn tail
+        }
+        end = good;
+        lseek(fd, end, SEEK_SET);
+        if (fdatasync(fd) != 0) return -1;
+        records = static_cast<size_t>(replayed);
+        return replayed;
+    }
+
+    // Returns false, with errno set, if the record could not be written or
+    // a group commit it triggered failed
+    bool append(Op op, const Payload& payload) {
+        record.clear();
+        encode(record, op, payload);
+        if (!writeFully(fd, record.data(), record.size())) {
+            // Cut off whatever part of the record was written, so replay
+            // still reaches every record before it
+            int error = errno;
+            if (ftruncate(fd, end) == 0) lseek(fd, end, SEEK_SET);
+            errno = error;
+            return false;
+        }
+        end += record.size();
+        ++records;
+        if (unsynced++ == 0) oldestUnsynced = std::chrono::steady_clock::now();
+        if (unsynced >= GROUP_COMMIT_RECORDS || std::chrono::steady_clock::now() - oldestUnsynced >= GROUP_COMMIT_INTERVAL) {
+            return commit();
+        }
+        return true;
+    }
+
+    // Make every appended record durable. Returns false, with errno set, if
+    // the sync failed; the records may then be lost.
+    bool commit() {
+        if (unsynced == 0) return true;
+        if (fdatasync(fd) != 0) return false;
+        unsynced = 0;
+        return true;
+    }
+
+    // Replace the whole journal with count records, encoded back to back,
+    // atomically: they are written and synced to a temporary file that is
+    // then renamed over the journal
+    bool rewrite(const std::vector<uint8_t>& encoded, size_t count) {
+        std::vector<uint8_t> bytes(MAGIC, MAGIC + sizeof(MAGIC));
+        bytes.insert(bytes.end(), encoded.begin(), encoded.end());
+
+        std::string temporary = path + ".tmp";
+        int out = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) return false;
+        if (!writeFully(out, bytes.data(), bytes.size()) || fsync(out) != 0 || rename(temporary.c_str(), path.c_str()) != 0) {
+            ::close(out);
+            ::unlink(temporary.c_str());
+            return false;
+        }
+        ::close(fd);
+        fd = out;
+        end = bytes.size();
+        unsynced = 0;
+        records = count;
+
+        // Make the rename itself durable
+        size_t slash = path.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        int dir = ::open(directory.c_str(), O_RDONLY);
+        if (dir >= 0) {
+            fsync(dir);
+            ::close(dir);
+        }
+        return true;
+    }
+};
+
+// Dense storage addressed by generational handles. Values live contiguously
+// and removal swaps the last value into the hole, so insert, lookup and
+// removal are all O(1). A slot's generation is bumped whenever its value is
+// removed, so handles to removed values are detected instead of aliasing
+// whatever reuses the slot.
+template <typename T>
+class SlotMap {
+public:
+    struct Handle {
+        uint32_t index = 0;
+        uint32_t generation = 0; // Slots start at generation 1, so a default handle is never live
+    };
+
+private:
+    static const uint32_t NO_SLOT = UINT32_MAX;
+
+    struct Slot {
+        uint32_t generation = 1;
+        uint32_t position = NO_SLOT; // Index into values when live, next free slot otherwise
+        bool live = false;
+    };
+
+    std::vector<T> values;
+    std::vector<uint32_t> owners; // Slot of each value, parallel to values
+    std::vector<Slot> slots;
+    uint32_t freeSlots = NO_SLOT;
+
+    void release(uint32_t index) {
+        Slot& slot = slots[index];
+        slot.live = false;
+        if (++slot.generation == 0) slot.generation = 1;
+        slot.position = freeSlots;
+        freeSlots = index;
+    }
+
+public:
+    Handle insert(T value) {
+        uint32_t index;
+        if (freeSlots != NO_SLOT) {
+            index = freeSlots;
+            freeSlots = slots[index].position;
+        } else {
+            index = static_cast<uint32_t>(slots.size());
+            slots.emplace_back();
+        }
+        Slot& slot = slots[index];
+        slot.live = true;
+        slot.position = static_cast<uint32_t>(values.size());
+        values.push_back(std::move(value));
+        owners.push_back(index);
+        return {index, slot.generation};
+    }
+
+    // The value behind the handle, or nullptr if it has been removed
+    T* get(Handle handle) {
+        if (handle.index >= slots.size()) return nullptr;
+        const Slot& slot = slots[handle.index];
+        return slot.live && slot.generation == handle.generation ? &values[slot.position] : nullptr;
+    }
+
+    const T* get(Handle handle) const {
+        return const_cast<SlotMap*>(this)->get(handle);
+    }
+
+    // The value in a slot known to be live
+    T& atSlot(uint32_t index) {
+        return values[slots[index].position];
+    }
+
+    const T& atSlot(uint32_t index) const {
+        return values[slots[index].position];
+    }
+
+    // The handle of the value at a position in the dense storage
+    Handle handleAt(size_t position) const {
+        uint32_t index = owners[position];
+        return {index, slots[index].generation};
+    }
+
+    void reserve(size_t count) {
+        values.reserve(count);
+        owners.reserve(count);
+        slots.reserve(count);
+    }
+
+    bool remove(Handle handle) {
+        if (!get(handle)) return false;
+        uint32_t position = slots[handle.index].position;
+        if (position + 1 != values.size()) {
+            values[position] = std::move(values.back());
+            owners[position] = owners.back();
+            slots[owners[position]].position = position;
+        }
+        values.pop_back();
+        owners.pop_back();
+        release(handle.index);
+        return true;
+    }
+
+    // Remove every value; outstanding handles all become stale
+    void clear() {
+        for (uint32_t index : owners) release(index);
+        values.clear();
+        owners.clear();
+    }
+
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+
+    // Iteration covers the values in storage order, not insertion order
+    typename std::vector<T>::iterator begin() { return values.begin(); }
+    typename std::vector<T>::iterator end() { return values.end(); }
+    typename std::vector<T>::const_iterator begin() const { return values.begin(); }
+    typename std::vector<T>::const_iterator end() const { return values.end(); }
+};
+
+// Undo history as a list of commands, each holding the state of every shape
+// it changed before and after, keyed by shape ID. A command is undone by
+// putting back the "before" states and redone by putting back the "after"
+// ones, so nothing else is replayed. Positions count the commands applied
+// since the session started; position 0 is the empty start.
+//
+// Jumps over many commands go through keyframes, full copies of the shapes
+// at some position. One is taken once the commands since the last one have
+// changed as many shapes as the board holds, so keyframes never use more
+// memory than the commands between them. Commands and keyframes count
+// against a byte budget; past it, the oldest entries are discarded.
+template <typename State>
+class History {
+public:
+    struct Change {
+        int id;
+        std::optional<State> before; // Absent if the shape did not exist
+        std::optional<State> after;  // Absent if the shape was removed
+    };
+
+    struct Command {
+        std::string description;
+        int widthBefore, heightBefore; // Board size, which only "new" changes
+        int widthAfter, heightAfter;
+        std::vector<Change> changes; // At most one per shape
+    };
+
+    struct Keyframe {
+        size_t position;
+        int width, height;
+        std::vector<State> shapes;
+    };
+
+private:
+    static constexpr size_t KEYFRAME_MIN_CHANGES = 1024;
+
+    std::deque<Command> commands; // Those after position first, oldest first
+    std::deque<Keyframe> keyframes; // Ordered by position
+    size_t first = 0;   // Position before the oldest command kept
+    size_t current = 0; // Position of the board
+    size_t budget;
+    size_t used = 0;
+    size_t sinceKeyframe = 0; // Changes recorded since the last keyframe
+
+    static size_t costOf(size_t changes) {
+        return sizeof(Command) + changes * sizeof(Change);
+    }
+
+    static size_t costOf(const Command& command) {
+        return costOf(command.changes.capacity()) + command.description.capacity();
+    }
+
+    static size_t costOf(const Keyframe& keyframe) {
+        return sizeof(Keyframe) + keyframe.shapes.capacity() * sizeof(State);
+    }
+
+    void dropOldest() {
+        used -= costOf(commands.front());
+        commands.pop_front();
+        ++first;
+        while (!keyframes.empty() && keyframes.front().position < first) {
+            used -= costOf(keyframes.front());
+            keyframes.pop_front();
+        }
+    }
+
+    void dropNewest() {
+        used -= costOf(commands.back());
+        commands.pop_back();
+        while (!keyframes.empty() && keyframes.back().position > newest()) {
+            used -= costOf(keyframes.back());
+            keyframes.pop_back();
+        }
+    }
+
+    // Discard the oldest commands until the budget is met, or the undone
+    // ones once everything before the board is gone
+    void trim() {
+        while (used > budget) {
+            if (commands.empty()) {
+                if (keyframes.empty()) break;
+                used -= costOf(keyframes.front());
+                keyframes.pop_front();
+            } else if (current > first) {
+                dropOldest();
+            } else {
+                dropNewest();
+            }
+        }
+    }
+
+public:
+    explicit History(size_t budget) : budget(budget) {}
+
+    void setBudget(size_t bytes) {
+        budget = bytes;
+        trim();
+    }
+
+    size_t position() const { return current; }
+    size_t oldest() const { return first; }
+    size_t newest() const { return first + commands.size(); }
+    size_t bytesUsed() const { return used; }
+
+    // The command that leads from position n - 1 to n, for oldest() < n <= newest()
+    const Command& entry(size_t n) const {
+        return commands[n - first - 1];
+    }
+
+    // Whether a command changing this many shapes can be kept at all
+    bool fits(size_t changes) const {
+        return costOf(changes) <= budget;
+    }
+
+    // Record a command just applied to the board, forgetting undone ones
+    void push(Command command) {
+        while (newest() > current) dropNewest();
+        sinceKeyframe += command.changes.size();
+        used += costOf(command);
+        commands.push_back(std::move(command));
+        ++current;
+        trim();
+    }
+
+    // Forget everything, as after a command too large to keep
+    void discard() {
+        commands.clear();
+        keyframes.clear();
+        first = current;
+        used = 0;
+        sinceKeyframe = 0;
+    }
+
+    // Move the board's position after applying commands to it
+    void moveTo(size_t position) {
+        current = position;
+    }
+
+    bool wantsKeyframe(size_t shapeCount) const {
+        return sinceKeyframe >= std::max(KEYFRAME_MIN_CHANGES, shapeCount) && costOf(shapeCount) <= budget / 4;
+    }
+
+    // Keep a copy of the board at the current position
+    void addKeyframe(int width, int height, std::vector<State> shapes) {
+        sinceKeyframe = 0;
+        if (!keyframes.empty() && keyframes.back().position == current) return;
+        keyframes.push_back({current, width, height, std::move(shapes)});
+        used += costOf(keyframes.back());
+        trim();
+    }
+
+    // The keyframe closest to a position, or nullptr
+    const Keyframe* nearestKeyframe(size_t position) const {
+        const Keyframe* nearest = nullptr;
+        size_t distance = SIZE_MAX;
+        for (const Keyframe& keyframe : keyframes) {
+            size_t d = keyframe.position > position ? keyframe.position - position : position - keyframe.position;
+            if (d < distance) {
+                nearest = &keyframe;
+                distance = d;
+            }
+        }
+        return nearest;
+    }
+
+    // Call visit(state) on every state held by commands and keyframes; the
+    // states may be changed in place
+    template <typename Visit>
+    void forEachState(Visit visit) {
+        for (Command& command : commands) {
+            for (Change& change : command.changes) {
+                if (change.before) visit(*change.before);
+                if (change.after) visit(*change.after);
+            }
+        }
+        for (Keyframe& keyframe : keyframes) {
+            for (State& state : keyframe.shapes) visit(state);
+        }
+    }
+
+    // Shapes changed by the commands between two positions
+    size_t changesBetween(size_t from, size_t to) const {
+        size_t changes = 0;
+        for (size_t n = std::min(from, to) + 1; n <= std::max(from, to); ++n) {
+            changes += entry(n).changes.size();
+        }
+        return changes;
+    }
+};
+
+// Retained-mode rendering state. The board is split into fixed-size tiles;
+// each tile knows which shapes overlap it and whether its cells are stale.
+// Shapes are ordered by their draw order, which is unique per shape and
+// higher for shapes drawn on top, and found through their slot index. Mutations damage the tiles under the old
+// and new bounds, and a redraw re-rasterizes only those tiles using only
+// their own shapes.
+class TileCache {
+    static const int TILE_WIDTH = 64;
+    static const int TILE_HEIGHT = 32;
+
+    struct Entry {
+        unsigned drawOrder;
+        uint32_t slot;
+
+        bool operator<(const Entry& other) const {
+            return drawOrder < other.drawOrder;
+        }
+    };
+
+    struct Tile {
+        std::vector<Entry> shapes; // Sorted by draw order
+        bool dirty = false;
+    };
+
+    int width, height;
+    int columns, rows;
+    std::vector<Tile> tiles;
+    std::vector<int> dirtyTiles;
+
+    // Visit the index of every tile overlapping the area
+    template <typename Visitor>
+    void forEachTile(const Rect& area, Visitor visit) {
+        Rect clipped = area.intersect({0, 0, width - 1, height - 1});
+        if (clipped.empty()) return;
+        for (int row = clipped.y0 / TILE_HEIGHT; row <= clipped.y1 / TILE_HEIGHT; ++row) {
+            for (int column = clipped.x0 / TILE_WIDTH; column <= clipped.x1 / TILE_WIDTH; ++column) {
+                visit(row * columns + column);
+            }
+        }
+    }
+
+    void markDirty(int index) {
+        if (!tiles[index].dirty) {
+            tiles[index].dirty = true;
+            dirtyTiles.push_back(index);
+        }
+    }
+
+public:
+    TileCache(int width, int height)
+    : width(width), height(height),
+      columns((width + TILE_WIDTH - 1) / TILE_WIDTH), rows((height + TILE_HEIGHT - 1) / TILE_HEIGHT),
+      tiles(static_cast<size_t>(columns) * rows) {}
+
+    // Mark every tile overlapping the area for redraw
+    void damage(const Rect& area) {
+        forEachTile(area, [this](int index) { markDirty(index); });
+    }
+
+    // Register a shape in the tiles under its bounds and damage them
+    void insert(unsigned drawOrder, uint32_t slot, const Rect& area) {
+        Entry entry{drawOrder, slot};
+        forEachTile(area, [&](int index) {
+            std::vector<Entry>& list = tiles[index].shapes;
+            if (list.empty() || list.back() < entry) {
+                list.push_back(entry); // The common case: the shape is the new topmost one
+            } else {
+                list.insert(std::upper_bound(list.begin(), list.end(), entry), entry);
+            }
+            markDirty(index);
+        });
+    }
+
+    // Unregister a shape from the tiles under the bounds it was inserted with
+    void remove(unsigned drawOrder, const Rect& area) {
+        Entry entry{drawOrder, 0};
+        forEachTile(area, [&](int index) {
+            std::vector<Entry>& list = tiles[index].shapes;
+            list.erase(std::lower_bound(list.begin(), list.end(), entry));
+            markDirty(index);
+        });
+    }
+
+    // Visit the slots of the shapes registered in the tile holding the cell,
+    // topmost first, until visit(slot) returns true. Returns whether it did.
+    // The cell must be on the board.
+    template <typename Visitor>
+    bool findAt(int x, int y, Visitor visit) const {
+        const Tile& tile = tiles[y / TILE_HEIGHT * columns + x / TILE_WIDTH];
+        for (auto entry = tile.shapes.rbegin(); entry != tile.shapes.rend(); ++entry) {
+            if (visit(entry->slot)) return true;
+        }
+        return false;
+    }
+
+    // Replace every draw order with renumbered(drawOrder), which must keep
+    // their order; nothing is damaged, as no cell changes
+    template <typename Renumber>
+    void renumber(Renumber renumbered) {
+        for (Tile& tile : tiles) {
+            for (Entry& entry : tile.shapes) entry.drawOrder = renumbered(entry.drawOrder);
+        }
+    }
+
+    // Forget every shape; the caller clears the framebuffer itself
+    void clear() {
+        for (Tile& tile : tiles) {
+            tile.shapes.clear();
+            tile.dirty = false;
+        }
+        dirtyTiles.clear();
+    }
+
+    // Re-rasterize every dirty tile into the span buffer's view;
+    // drawShape(slot, spans) rasterizes one shape
+    template <typename DrawShape>
+    void redraw(SpanBuffer& spans, DrawShape drawShape) {
+        for (int index : dirtyTiles) {
+            Tile& tile = tiles[index];
+            int x0 = index % columns * TILE_WIDTH;
+            int y0 = index / columns * TILE_HEIGHT;
+            Rect area = Rect{x0, y0, x0 + TILE_WIDTH - 1, y0 + TILE_HEIGHT - 1}.intersect({0, 0, width - 1, height - 1});
+
+            spans.clear();
+            spans.setClip(area);
+            spans.setOwner(0);
+            for (int y = area.y0; y <= area.y1; ++y) {
+                spans.add(y, area.x0, area.x1, ' ');
+            }
+            for (const Entry& entry : tile.shapes) {
+                drawShape(entry.slot, spans);
+            }
+            spans.composite();
+            tile.dirty = false;
+        }
+        dirtyTiles.clear();
+    }
+};
+
+// Turns a frame into the bytes shown on the terminal: a dashed border above
+// and below, and each row between '|' characters. Colour escapes are only
+// emitted where the colour changes between neighbouring cells, and the whole
+// frame is built in one buffer that is reused between frames.
+class FrameEncoder {
+    // Longest escape sequence, "\033[3Xm" or "\033[0m"
+    static const size_t MAX_ESCAPE = 5;
+
+    std::vector<char> buffer;
+    size_t length = 0;
+
+    static char* append(char* out, const char* text, size_t count) {
+        std::memcpy(out, text, count);
+        return out + count;
+    }
+
+    // Make room for bytes more at out, growing the buffer by at least half;
+    // returns out in the possibly moved buffer
+    char* reserve(char* out, size_t bytes) {
+        size_t at = out - buffer.data();
+        if (buffer.size() - at < bytes) buffer.resize(std::max(buffer.size() + buffer.size() / 2, at + bytes));
+        return buffer.data() + at;
+    }
+
+public:
+    // Escape selecting the colour of a cell's character, or nullptr for the default colour
+    static const char* escapeFor(char cell) {
+        switch (cell) {
+            case 'r': return "\033[31m"; // Red
+            case 'g': return "\033[32m"; // Green
+            case 'b': return "\033[34m"; // Blue
+            case 'y': return "\033[33m"; // Yellow
+            default: return nullptr;
+        }
+    }
+
+    // Encode the view into the buffer, replacing the previous frame
+    void encode(const FrameView& view) {
+        // Worst case of one row: every cell switches colour, and the row ends with a reset
+        size_t rowBytes = static_cast<size_t>(view.width) * (MAX_ESCAPE + 1) + MAX_ESCAPE + 3;
+        size_t borderBytes = static_cast<size_t>(view.width) + 3;
+        // The buffer starts out sized for a frame without colour changes and
+        // grows row by row as escapes need more, rather than for the worst case
+        size_t initial = borderBytes * (view.height + 2) + rowBytes;
+        if (buffer.size() < initial) buffer.resize(initial);
+
+        char* out = buffer.data();
+        std::memset(out, '-', borderBytes - 1);
+        out += borderBytes - 1;
+        *out++ = '\n';
+
+        for (int y = 0; y < view.height; ++y) {
+            out = reserve(out, rowBytes + borderBytes); // This row and the closing border
+            const char* row = view.row(y);
+            const char* active = nullptr; // Escape in effect; rows start in the default colour
+            *out++ = '|';
+            for (int x = 0; x < view.width; ++x) {
+                const char* escape = escapeFor(row[x]);
+                if (escape != active) {
+                    out = append(out, escape ? escape : "\033[0m", escape ? MAX_ESCAPE : 4);
+                    active = escape;
+                }
+                *out++ = row[x];
+            }
+            if (active) out = append(out, "\033[0m", 4); // The border is never coloured
+            *out++ = '|';
+            *out++ = '\n';
+        }
+
+        std::memset(out, '-', borderBytes - 1);
+        out += borderBytes - 1;
+        *out++ = '\n';
+        length = out - buffer.data();
+    }
+
+    const char* data() const {
+        return buffer.data();
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    // Write the encoded frame to a file descriptor, normally in one write(2)
+    bool writeTo(int fd) const {
+        return writeFully(fd, buffer.data(), length);
+    }
+};
+
+// Pixel formats of the headless backend: binary PPM (RGB) and PGM (grey)
+enum class ImageFormat {
+    PPM,
+    PGM
+};
+
+// Headless backend: turns frame rows into image rows. Every cell becomes a
+// scale x scale block of pixels; empty cells are black, coloured cells take
+// their colour and any other character is white chalk. Rows are encoded one
+// at a time so callers can stream arbitrarily large frames.
+class ImageEncoder {
+public:
+    static const int MAX_SCALE = 64;
+
+    static int channels(ImageFormat format) {
+        return format == ImageFormat::PPM ? 3 : 1;
+    }
+
+    // Bytes in one row of pixels
+    static size_t rowBytes(int width, int scale, ImageFormat format) {
+        return static_cast<size_t>(width) * scale * channels(format);
+    }
+
+    // Pixel bytes of a whole frame, without any header
+    static size_t imageBytes(int width, int height, int scale, ImageFormat format) {
+        return rowBytes(width, scale, format) * height * scale;
+    }
+
+    // The "P6"/"P5" header written before the pixels of a file
+    static std::string header(int width, int height, int scale, ImageFormat format) {
+        return std::string(format == ImageFormat::PPM ? "P6" : "P5") + "\n" +
+               std::to_string(static_cast<long long>(width) * scale) + " " +
+               std::to_string(static_cast<long long>(height) * scale) + "\n255\n";
+    }
+
+    // One row of pixels for a row of cells; out holds rowBytes() bytes
+    static void encodeRow(const char* cells, int width, int scale, ImageFormat format, uint8_t* out) {
+        int size = channels(format);
+        for (int x = 0; x < width; ++x) {
+            uint8_t pixel[3];
+            colorOf(cells[x], pixel);
+            if (format == ImageFormat::PGM) {
+                pixel[0] = static_cast<uint8_t>((299 * pixel[0] + 587 * pixel[1] + 114 * pixel[2]) / 1000);
+            }
+            for (int i = 0; i < scale; ++i) {
+                std::memcpy(out, pixel, size);
+                out += size;
+            }
+        }
+    }
+
+private:
+    static void colorOf(char cell, uint8_t* rgb) {
+        switch (cell) {
+            case ' ': rgb[0] = 0;   rgb[1] = 0;   rgb[2] = 0;   break;
+            case 'r': rgb[0] = 255; rgb[1] = 0;   rgb[2] = 0;   break;
+            case 'g': rgb[0] = 0;   rgb[1] = 255; rgb[2] = 0;   break;
+            case 'b': rgb[0] = 0;   rgb[1] = 0;   rgb[2] = 255; break;
+            case 'y': rgb[0] = 255; rgb[1] = 255; rgb[2] = 0;   break;
+            default:  rgb[0] = 255; rgb[1] = 255; rgb[2] = 255; break;
+        }
+    }
+};
+
+// Interactive terminal backend. The board is kept on the alternate screen,
+// above a scroll region that holds the prompt and command output, and each
+// frame only repaints the runs of cells that differ from what is already on
+// screen: a cursor move plus the new cells. Unchanged rows cost nothing.
+class TerminalRenderer {
+    // Unchanged cells closer than this are repainted rather than skipped,
+    // since a cursor move costs about as many bytes
+    static const int MERGE_GAP = 8;
+
+    std::vector<char> shown; // Cells on screen, rows back to back
+    int shownWidth = 0, shownHeight = 0;
+    bool active = false;     // On the alternate screen
+    std::string out;
+
+    static winsize terminalSize() {
+        winsize size{};
+        ioctl(STDOUT_FILENO, TIOCGWINSZ, &size);
+        return size;
+    }
+
+    void appendNumber(int value) {
+        char digits[16];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        out.append(digits, result.ptr);
+    }
+
+    // Cursor to a zero-based screen position
+    void moveTo(int row, int column) {
+        out += "\033[";
+        appendNumber(row + 1);
+        out += ';';
+        appendNumber(column + 1);
+        out += 'H';
+    }
+
+    // Cells with their colours, leaving the default colour active afterwards
+    void appendCells(const char* cells, int count) {
+        const char* active = nullptr;
+        for (int i = 0; i < count; ++i) {
+            const char* escape = FrameEncoder::escapeFor(cells[i]);
+            if (escape != active) {
+                out += escape ? escape : "\033[0m";
+                active = escape;
+            }
+            out += cells[i];
+        }
+        if (active) out += "\033[0m";
+    }
+
+    // Callers flush std::cout first, on the thread that writes to it
+    void flush() {
+        writeFully(STDOUT_FILENO, out.data(), out.size());
+    }
+
+    void repaintAll(const FrameView& view, int rows) {
+        out += "\033[r\033[2J\033[H"; // Drop any scroll region, clear, home
+        std::string border(view.width + 2, '-');
+        out += border;
+        out += "\r\n";
+        for (int y = 0; y < view.height; ++y) {
+            out += '|';
+            appendCells(view.row(y), view.width);
+            out += "|\r\n";
+        }
+        out += border;
+
+        // Command output scrolls below the board, never over it
+        out += "\033[";
+        appendNumber(view.height + 3);
+        out += ';';
+        appendNumber(rows);
+        out += 'r';
+        moveTo(view.height + 2, 0);
+
+        shownWidth = view.width;
+        shownHeight = view.height;
+        shown.resize(static_cast<size_t>(view.width) * view.height);
+        for (int y = 0; y < view.height; ++y) {
+            std::memcpy(shown.data() + static_cast<size_t>(y) * view.width, view.row(y), view.width);
+        }
+    }
+
+    void repaintChanges(const FrameView& view) {
+        out += "\0337"; // Save the cursor, which sits at the prompt
+        for (int y = 0; y < view.height; ++y) {
+            const char* row = view.row(y);
+            char* previous = shown.data() + static_cast<size_t>(y) * view.width;
+            if (std::memcmp(row, previous, view.width) == 0) continue;
+
+            int x = 0;
+            while (x < view.width) {
+                if (row[x] == previous[x]) {
+                    ++x;
+                    continue;
+                }
+                // A run of changes, extended across short unchanged gaps
+                int start = x, end = x + 1, gap = 0;
+                for (int i = x + 1; i < view.width && gap < MERGE_GAP; ++i) {
+                    if (row[i] != previous[i]) {
+                        end = i + 1;
+                        gap = 0;
+                    } else {
+                        ++gap;
+                    }
+                }
+                moveTo(y + 1, start + 1); // Past the top border and the '|'
+                appendCells(row + start, end - start);
+                std::memcpy(previous + start, row + start, end - start);
+                x = end;
+            }
+        }
+        out += "\0338"; // Back to the prompt
+    }
+
+public:
+    // Whether stdout is a terminal this backend can drive
+    static bool supported() {
+        return isatty(STDOUT_FILENO);
+    }
+
+    ~TerminalRenderer() {
+        std::cout.flush(); // Keep anything printed since the last frame on the alternate screen
+        leave();
+    }
+
+    // Show the view, repainting only what changed since the last call.
+    // Returns false, leaving the screen alone, when the terminal is too
+    // small to keep the board and a prompt line on screen together.
+    bool present(const FrameView& view) {
+        winsize size = terminalSize();
+        int rows = size.ws_row;
+        if (rows < view.height + 3 || size.ws_col < view.width + 2) {
+            leave();
+            return false;
+        }
+
+        out.clear();
+        if (!active) {
+            out += "\033[?1049h"; // Alternate screen
+            active = true;
+            shownWidth = shownHeight = 0;
+        }
+        if (view.width != shownWidth || view.height != shownHeight) {
+            repaintAll(view, rows);
+        } else {
+            repaintChanges(view);
+        }
+        flush();
+        return true;
+    }
+
+    // Restore the normal screen
+    void leave() {
+        if (!active) return;
+        out = "\033[r\033[?1049l";
+        flush();
+        active = false;
+    }
+};
+
+// Presents frames on a dedicated thread. Requests only set a flag, so the
+// thread asking never waits on the terminal; the worker renders the latest
+// state at most once per interval, coalescing every request made while it
+// was busy or waiting into that one frame.
+class RenderThread {
+    std::function<void()> renderFrame;
+    std::chrono::milliseconds interval;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool requested = false;
+    bool stopping = false;
+    std::thread worker; // Last, so it starts after the state above exists
+
+    void run() {
+        auto nextFrame = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return requested || stopping; });
+            if (!requested) return; // Stopping with nothing left to show
+            if (!stopping) {
+                // Let requests pile up until the interval has passed
+                wake.wait_until(lock, nextFrame, [this] { return stopping; });
+            }
+            requested = false;
+            lock.unlock();
+            renderFrame();
+            nextFrame = std::chrono::steady_clock::now() + interval;
+            lock.lock();
+        }
+    }
+
+public:
+    RenderThread(std::function<void()> renderFrame, std::chrono::milliseconds interval)
+    : renderFrame(std::move(renderFrame)), interval(interval), worker([this] { run(); }) {}
+
+    // Presents the last requested frame, if any, before returning
+    ~RenderThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    void request() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requested = true;
+        }
+        wake.notify_one();
+    }
+};
+
+struct Board {
+private:
+    Framebuffer frame;
+    SpanBuffer spans;
+    TileCache tiles;
+    FrameEncoder encoder;
+    std::unique_ptr<TerminalRenderer> terminal; // Diff rendering, when enabled
+    bool headless = false; // Frames are only ever rendered to images
+    bool quiet = false;    // Confirmations of successful commands are dropped
+    std::ostream discard{nullptr};
+    // With a render thread, frame is guarded by frameMutex and the thread
+    // presents copies of it taken into snapshot, which stays empty until the
+    // first frame it presents
+    std::mutex frameMutex;
+    Framebuffer snapshot;
+    // ID of the topmost shape on each cell, 0 where none is; filled while
+    // rasterizing. Left empty until the first point query needs it, then kept
+    // up to date by every redraw: 4 bytes per cell, so only boards of up to
+    // PICK_BUFFER_MAX_CELLS cells use one.
+    std::vector<uint32_t> pickCells;
+    struct PlacedShape {
+        ShapeRecord shape;
+        unsigned drawOrder; // Higher is drawn on top
+    };
+    using ShapeHandle = SlotMap<PlacedShape>::Handle;
+
+    unsigned nextDrawOrder = 0;
+    SlotMap<PlacedShape> shapes;
+    std::vector<ShapeHandle> handlesByID; // Indexed by ID - 1; removed shapes leave stale handles
+    int currentShapeID = 1;
+    int selectedShapeID = -1;
+    ShapeHandle selected;
+    std::unique_ptr<Journal> journal; // Mutations are logged here, when enabled
+    bool journalMuted = false;        // While loading or replaying
+    Journal::Payload journalPayload;
+    using BoardHistory = History<PlacedShape>;
+    BoardHistory history{static_cast<size_t>(DEFAULT_HISTORY_BUDGET_MB) << 20};
+    bool historyMuted = false; // While loading, replaying or moving through the history
+    std::unique_ptr<RenderThread> renderThread; // Last, so it stops before the state it reads is destroyed
+
+    // The journal is compacted once it holds this many records, or twice as
+    // many as there are shapes if that is more
+    static constexpr size_t COMPACT_MIN_RECORDS = 4096;
+
+    // Larger boards answer point queries from the tile grid instead of a
+    // pick buffer (64 MiB at this size)
+    static constexpr size_t PICK_BUFFER_MAX_CELLS = size_t(1) << 24;
+
+    // Draw orders are renumbered once the next one reaches this, long before
+    // the counter could wrap. While a command holds shapes outside the board
+    // and history (the history is muted then), only the last possible draw
+    // order triggers it.
+    static constexpr unsigned RENUMBER_DRAW_ORDERS_AT = 1u << 31;
+
+    // A draw order above every one in use, for a shape put on top
+    unsigned takeDrawOrder() {
+        if (nextDrawOrder >= (historyMuted ? std::numeric_limits<unsigned>::max() : RENUMBER_DRAW_ORDERS_AT)) {
+            renumberDrawOrders();
+        }
+        return nextDrawOrder++;
+    }
+
+    // Number the draw orders of the board and its history 0, 1, 2, ... in
+    // their current order, so relative order, and with it every frame, and
+    // undo and redo, stay the same
+    void renumberDrawOrders() {
+        std::vector<unsigned> orders;
+        orders.reserve(shapes.size());
+        for (const PlacedShape& placed : shapes) orders.push_back(placed.drawOrder);
+        history.forEachState([&orders](const PlacedShape& state) { orders.push_back(state.drawOrder); });
+        std::sort(orders.begin(), orders.end());
+        orders.erase(std::unique(orders.begin(), orders.end()), orders.end());
+        auto renumbered = [&orders](unsigned drawOrder) {
+            return static_cast<unsigned>(std::lower_bound(orders.begin(), orders.end(), drawOrder) - orders.begin());
+        };
+
+        for (PlacedShape& placed : shapes) placed.drawOrder = renumbered(placed.drawOrder);
+        tiles.renumber(renumbered);
+        history.forEachState([&renumbered](PlacedShape& state) { state.drawOrder = renumbered(state.drawOrder); });
+        nextDrawOrder = static_cast<unsigned>(orders.size());
+
+        // Replay would not renumber at the same point: restart the journal from the renumbered board
+        if (journaling() && !compactJournal()) stopJournal();
+    }
+
+    // Give a new shape the next ID and put it on top of the others
+    void addShape(ShapeRecord record) {
+        unsigned drawOrder = takeDrawOrder();
+        const PlacedShape& placed = placeShape(std::move(record), currentShapeID++, drawOrder);
+        if (journaling()) {
+            encodeShape(placed.shape);
+            log(Journal::ADD);
+        }
+        if (!historyMuted) {
+            const ShapeRecord& shape = placed.shape;
+            recordChange("add " + std::get<0>(parametersOf(shape)) + " " + std::to_string(shapeOf(shape).getID()),
+                         shapeOf(shape).getID(), std::nullopt, placed);
+        }
+    }
+
+    // Register a shape under an ID and draw order that are not in use
+    const PlacedShape& placeShape(ShapeRecord record, int id, unsigned drawOrder) {
+        shapeOf(record).setID(id);
+        Rect bounds = boundsOf(record);
+        ShapeHandle handle = shapes.insert({std::move(record), drawOrder});
+        if (handlesByID.size() < static_cast<size_t>(id)) handlesByID.resize(id); // Unused IDs stay stale
+        handlesByID[id - 1] = handle;
+        tiles.insert(drawOrder, handle.index, bounds);
+        return shapes.atSlot(handle.index);
+    }
+
+    // Put the shape with the ID into a recorded state, or remove it if the
+    // state is absent, whatever it is now
+    void placeAt(int id, const std::optional<PlacedShape>& state) {
+        bool existed = findByID(id) != nullptr;
+        if (existed) erase(handlesByID[id - 1]);
+        if (state) {
+            placeShape(state->shape, id, state->drawOrder);
+            nextDrawOrder = std::max(nextDrawOrder, state->drawOrder + 1);
+            currentShapeID = std::max(currentShapeID, id + 1);
+        }
+        if (!journaling()) return;
+        if (state) {
+            encodeShape(state->shape, state->drawOrder);
+            log(Journal::PLACE);
+        } else if (existed) {
+            payload().int32(id);
+            log(Journal::REMOVE);
+        }
+    }
+
+    // Add a shape under the ID recorded for it in the journal
+    void restoreShape(ShapeRecord record, int id) {
+        if (id < 1 || findByID(id)) return;
+        currentShapeID = std::max(currentShapeID, id + 1);
+        placeShape(std::move(record), id, takeDrawOrder());
+    }
+
+    bool journaling() const {
+        return journal && !journalMuted;
+    }
+
+    // The payload of the next record, emptied
+    Journal::Payload& payload() {
+        journalPayload.clear();
+        return journalPayload;
+    }
+
+    // The payload of an ADD record, or of a PLACE record given the draw order
+    void encodeShape(const ShapeRecord& record, std::optional<unsigned> drawOrder = std::nullopt) {
+        auto [type, x, y, param1, param2, fill, color] = parametersOf(record);
+        payload().int32(shapeOf(record).getID()).byte(static_cast<uint8_t>(record.index()))
+                 .byte(static_cast<uint8_t>(shapeOf(record).getFillMode()))
+                 .int32(x).int32(y).int32(param1).int32(param2);
+        if (drawOrder) journalPayload.int32(static_cast<int>(*drawOrder));
+        journalPayload.text(color);
+    }
+
+    // Append the record whose payload was just built, compacting when due
+    void log(Journal::Op op) {
+        if (!journal->append(op, journalPayload)) {
+            stopJournal();
+            return;
+        }
+        if (journal->size() > std::max(COMPACT_MIN_RECORDS, 2 * shapes.size())) {
+            compactJournal();
+        }
+    }
+
+    // After a failed write or sync the journal can no longer follow the
+    // board, and appending past a lost record would replay a different
+    // board: report the error and log nothing more
+    void stopJournal() {
+        std::cerr << "Error: could not write the journal " << journal->getPath() << " (" << std::strerror(errno)
+                  << "); changes are no longer journaled.\n";
+        journal.reset();
+    }
+
+    // Rewrite the journal as a snapshot of the board: its size, every shape
+    // with its ID and draw order, and the next ID and draw order. Returns
+    // false, leaving the journal as it was, if it cannot be rewritten
+    bool compactJournal() {
+        std::vector<uint8_t> encoded;
+        Journal::encode(encoded, Journal::RESIZE, payload().int32(getWidth()).int32(getHeight()));
+        for (const PlacedShape& placed : shapes) {
+            encodeShape(placed.shape, placed.drawOrder);
+            Journal::encode(encoded, Journal::PLACE, journalPayload);
+        }
+        Journal::encode(encoded, Journal::NEXT_ID, payload().int32(currentShapeID).int32(static_cast<int>(nextDrawOrder)));
+        if (!journal->rewrite(encoded, shapes.size() + 2)) {
+            std::cerr << "Error: could not compact the journal " << journal->getPath() << ".\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Apply one journal record during replay
+    void applyJournal(Journal::Op op, Journal::Reader& reader) {
+        int id, a, b;
+        uint8_t kind, fill;
+        switch (op) {
+            case Journal::ADD:
+            case Journal::PLACE: {
+                int x, y, drawOrder = 0;
+                if (reader.int32(id) && reader.byte(kind) && reader.byte(fill) && reader.int32(x) && reader.int32(y) &&
+                    reader.int32(a) && reader.int32(b) && (op == Journal::ADD || reader.int32(drawOrder)) &&
+                    id >= 1 && kind <= SceneFormat::LINE && fill <= static_cast<uint8_t>(FillMode::Fill)) {
+                    uint16_t color = ColorPalette::instance().intern(reader.text());
+                    ShapeRecord shape = makeShape(kind, x, y, a, b, static_cast<FillMode>(fill), color);
+                    if (op == Journal::ADD) {
+                        restoreShape(std::move(shape), id);
+                    } else {
+                        placeAt(id, PlacedShape{std::move(shape), static_cast<unsigned>(drawOrder)});
+                    }
+                }
+                break;
+            }
+            case Journal::MOVE:
+                if (reader.int32(id) && reader.int32(a) && reader.int32(b) && findByID(id)) {
+                    setSelection(id);
+                    move(a, b);
+                }
+                break;
+            case Journal::PAINT:
+                if (reader.int32(id) && findByID(id)) {
+                    setSelection(id);
+                    paint(reader.text());
+                }
+                break;
+            case Journal::EDIT:
+                if (reader.int32(id) && reader.int32(a) && reader.int32(b) && findByID(id)) {
+                    setSelection(id);
+                    edit(a, b);
+                }
+                break;
+            case Journal::REMOVE:
+                if (reader.int32(id)) placeAt(id, std::nullopt);
+                break;
+            case Journal::CLEAR:
+                clearShapes();
+                break;
+            case Journal::RESIZE:
+                if (reader.int32(a) && reader.int32(b) && isValidSize(a, b)) reset(a, b);
+                break;
+            case Journal::NEXT_ID:
+                if (reader.int32(id) && id > currentShapeID) currentShapeID = id;
+                if (reader.int32(a) && static_cast<unsigned>(a) > nextDrawOrder) nextDrawOrder = static_cast<unsigned>(a);
+                break;
+        }
+        deselect();
+    }
+
+    // Record a command that changed one shape
+    void recordChange(std::string description, int id, std::optional<PlacedShape> before, std::optional<PlacedShape> after) {
+        BoardHistory::Command command{std::move(description), getWidth(), getHeight(), getWidth(), getHeight(), {}};
+        command.changes.push_back({id, std::move(before), std::move(after)});
+        record(std::move(command));
+    }
+
+    void record(BoardHistory::Command command) {
+        history.push(std::move(command));
+        if (history.wantsKeyframe(shapes.size())) {
+            history.addKeyframe(getWidth(), getHeight(), std::vector<PlacedShape>(shapes.begin(), shapes.end()));
+        }
+    }
+
+    void forgetHistory() {
+        history.discard();
+        std::cout << "This change exceeds the history budget and cannot be undone.\n";
+    }
+
+    // Copy every shape ahead of a command that replaces them all. Returns
+    // false, forgetting the history, if the command could not be kept.
+    bool copyShapes(std::vector<PlacedShape>& copy) {
+        if (historyMuted) return false;
+        if (!history.fits(shapes.size())) {
+            forgetHistory();
+            return false;
+        }
+        copy.assign(shapes.begin(), shapes.end());
+        return true;
+    }
+
+    // Record a command that replaced the copied shapes with those now on the board
+    void recordReplacement(std::string description, std::vector<PlacedShape> before, int widthBefore, int heightBefore) {
+        if (!history.fits(before.size() + shapes.size())) {
+            forgetHistory();
+            return;
+        }
+        BoardHistory::Command command{std::move(description), widthBefore, heightBefore, getWidth(), getHeight(), {}};
+        command.changes.reserve(before.size() + shapes.size());
+        for (PlacedShape& placed : before) {
+            int id = shapeOf(placed.shape).getID();
+            command.changes.push_back({id, std::move(placed), std::nullopt});
+        }
+        for (const PlacedShape& placed : shapes) {
+            command.changes.push_back({shapeOf(placed.shape).getID(), std::nullopt, placed});
+        }
+        record(std::move(command));
+    }
+
+    // Undo (forward = false) or redo a recorded command
+    void applyCommand(const BoardHistory::Command& command, bool forward) {
+        int width = forward ? command.widthAfter : command.widthBefore;
+        int height = forward ? command.heightAfter : command.heightBefore;
+        if (width != getWidth() || height != getHeight()) reset(width, height);
+        for (const BoardHistory::Change& change : command.changes) {
+            placeAt(change.id, forward ? change.after : change.before);
+        }
+    }
+
+    // Bring the board to a position in the history, through the nearest
+    // keyframe when that touches fewer shapes than stepping there
+    void travelTo(size_t target) {
+        historyMuted = true;
+        size_t from = history.position();
+        const BoardHistory::Keyframe* keyframe = history.nearestKeyframe(target);
+        if (keyframe && keyframe->shapes.size() + shapes.size() + history.changesBetween(keyframe->position, target) <
+                        history.changesBetween(from, target)) {
+            reset(keyframe->width, keyframe->height);
+            for (const PlacedShape& placed : keyframe->shapes) {
+                placeAt(shapeOf(placed.shape).getID(), placed);
+            }
+            from = keyframe->position;
+        }
+        for (; from < target; ++from) applyCommand(history.entry(from + 1), true);
+        for (; from > target; --from) applyCommand(history.entry(from), false);
+        history.moveTo(target);
+        historyMuted = false;
+
+        // The selected shape may have been removed, or put back under a new handle
+        if (selectedShapeID != -1 && findByID(selectedShapeID)) {
+            setSelection(selectedShapeID);
+        } else {
+            deselect();
+        }
+    }
+
+    // The live shape with the ID, or nullptr
+    PlacedShape* findByID(int id) {
+        if (id < 1 || id > static_cast<int>(handlesByID.size())) return nullptr;
+        return shapes.get(handlesByID[id - 1]);
+    }
+
+    void setSelection(int id) {
+        selectedShapeID = id;
+        selected = handlesByID[id - 1];
+    }
+
+    void deselect() {
+        selectedShapeID = -1;
+        selected = ShapeHandle();
+    }
+
+    // The shapes from back to front
+    std::vector<const PlacedShape*> inDrawOrder() const {
+        std::vector<const PlacedShape*> ordered;
+        ordered.reserve(shapes.size());
+        for (const PlacedShape& placed : shapes) ordered.push_back(&placed);
+        std::sort(ordered.begin(), ordered.end(), [](const PlacedShape* a, const PlacedShape* b) {
+            return a->drawOrder < b->drawOrder;
+        });
+        return ordered;
+    }
+
+    bool usesPickBuffer() const {
+        return static_cast<size_t>(getWidth()) * getHeight() <= PICK_BUFFER_MAX_CELLS;
+    }
+
+    // Start recording cell owners; every tile is redrawn once to fill them in
+    void enablePicking() {
+        if (!pickCells.empty()) return;
+        pickCells.assign(static_cast<size_t>(getWidth()) * getHeight(), 0);
+        spans.setPickTarget(pickCells.data());
+        tiles.damage({0, 0, getWidth() - 1, getHeight() - 1});
+    }
+
+    // Re-rasterize only the tiles damaged since the last refresh
+    void refresh() {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        tiles.redraw(spans, [this](uint32_t slot, SpanBuffer& target) {
+            const ShapeRecord& shape = shapes.atSlot(slot).shape;
+            target.setOwner(shapeOf(shape).getID());
+            std::visit([&target](const auto& s) { s.draw(target); }, shape);
+        });
+    }
+
+    // The topmost shape drawn on the cell, or nullptr. Cells on the board
+    // are read from the pick buffer once the frame is current; on boards too
+    // large for one, only the shapes registered in the cell's tile are
+    // tested. Points off the board, which are never drawn, test every
+    // shape's containsPoint instead.
+    const PlacedShape* topmostAt(int x, int y) {
+        const PlacedShape* hit = nullptr;
+        if (x >= 0 && x < getWidth() && y >= 0 && y < getHeight()) {
+            if (usesPickBuffer()) {
+                enablePicking();
+                refresh();
+                return findByID(pickCells[static_cast<size_t>(y) * getWidth() + x]);
+            }
+            tiles.findAt(x, y, [&](uint32_t slot) {
+                const PlacedShape& placed = shapes.atSlot(slot);
+                if (contains(placed.shape, x, y)) hit = &placed;
+                return hit != nullptr;
+            });
+            return hit;
+        }
+        for (const PlacedShape& placed : shapes) {
+            if ((!hit || placed.drawOrder > hit->drawOrder) && contains(placed.shape, x, y)) {
+                hit = &placed;
+            }
+        }
+        return hit;
+    }
+
+    // Unregister a shape from the tiles and the slot map
+    void erase(ShapeHandle handle) {
+        const PlacedShape& placed = *shapes.get(handle);
+        tiles.remove(placed.drawOrder, boundsOf(placed.shape));
+        shapes.remove(handle);
+    }
+
+    static Rect boundsOf(const ShapeRecord& record) {
+        return std::visit([](const auto& shape) { return shape.bounds(); }, record);
+    }
+
+    static bool contains(const ShapeRecord& record, int x, int y) {
+        return std::visit([x, y](const auto& shape) { return shape.containsPoint(x, y); }, record);
+    }
+
+    static std::tuple<std::string, int, int, int, int, std::string, std::string> parametersOf(const ShapeRecord& record) {
+        return std::visit([](const auto& shape) { return shape.getParameters(); }, record);
+    }
+
+public:
+    Board(int width = DEFAULT_BOARD_WIDTH, int height = DEFAULT_BOARD_HEIGHT)
+    : frame(width, height), spans(frame.view()), tiles(width, height), snapshot(0, 0) {}
+
+    // Never draw to the terminal; frames are only rendered to images
+    void useHeadless() {
+        headless = true;
+    }
+
+    // Drop the messages confirming that commands succeeded; errors and the
+    // output of queries such as "list" are still printed
+    void useQuiet() {
+        quiet = true;
+    }
+
+    // Where confirmations of successful commands are printed
+    std::ostream& confirm() {
+        return quiet ? discard : std::cout;
+    }
+
+    // Present frames from a render thread, at most one per interval, from now on
+    void useRenderThread(std::chrono::milliseconds interval) {
+        renderThread = std::make_unique<RenderThread>([this] { presentSnapshot(); }, interval);
+    }
+
+    // Log every change to the shapes to a journal file from now on, after
+    // replaying what it already holds. Returns false if it cannot be used
+    bool useJournal(const std::string& path) {
+        journal = std::make_unique<Journal>(path);
+        journalMuted = true;
+        historyMuted = true;
+        std::streambuf* output = std::cout.rdbuf(nullptr); // Replayed commands print nothing
+        long long replayed = journal->open([this](Journal::Op op, Journal::Reader& reader) { applyJournal(op, reader); });
+        std::cout.rdbuf(output);
+        journalMuted = false;
+        historyMuted = false;
+        if (replayed < 0) {
+            journal.reset();
+            return false;
+        }
+        if (replayed == 0) compactJournal(); // Start with the board size
+        confirm() << "Recovered " << replayed << " records from " << path << ".\n";
+        return true;
+    }
+
+    // Called before waiting for input: make what was journaled durable now
+    // instead of whenever the next record is appended
+    void idle() {
+        if (journal && !journal->commit()) stopJournal();
+    }
+
+    static bool isValidSize(int width, int height) {
+        return width > 0 && height > 0 && width <= MAX_BOARD_SIZE && height <= MAX_BOARD_SIZE;
+    }
+
+    // Draw through the terminal diff renderer from now on
+    void useTerminalRenderer() {
+        terminal = std::make_unique<TerminalRenderer>();
+    }
+
+    int getWidth() const {
+        return frame.getWidth();
+    }
+
+    int getHeight() const {
+        return frame.getHeight();
+    }
+
+    // Replace the board with an empty one of the given size
+    void reset(int width, int height) {
+        std::vector<PlacedShape> before;
+        int widthBefore = getWidth(), heightBefore = getHeight();
+        bool recording = copyShapes(before);
+        clearShapes();
+        if (journaling()) {
+            payload().int32(width).int32(height);
+            log(Journal::RESIZE);
+        }
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            frame = Framebuffer(width, height);
+            spans = SpanBuffer(frame.view());
+            tiles = TileCache(width, height);
+            pickCells = std::vector<uint32_t>();
+        }
+        if (recording) {
+            recordReplacement("new " + std::to_string(width) + "x" + std::to_string(height), std::move(before), widthBefore, heightBefore);
+        }
+    }
+
+    bool isOccupied(int x, int y) {
+        return topmostAt(x, y) != nullptr; // Occupied if any shape contains the point
+    }
+    void addCircle(int x, int y, int radius, std::string_view fill, std::string_view color) {
+        addShape(Circle(x, y, radius, parseFillMode(fill), ColorPalette::instance().intern(color)));
+    }
+
+    // Add a Rectangle to the board
+    void addRectangle(int x, int y, int width, int height, std::string_view fill, std::string_view color) {
+        addShape(Rectangle(x, y, width, height, parseFillMode(fill), ColorPalette::instance().intern(color)));
+    }
+
+    // Add a Triangle to the board
+    void addTriangle(int x, int y, int height, std::string_view fill, std::string_view color) {
+        addShape(Triangle(x, y, height, parseFillMode(fill), ColorPalette::instance().intern(color)));
+    }
+
+    // Add a Line to the board
+    void addLine(int x1, int y1, int x2, int y2, std::string_view fill, std::string_view color) {
+        addShape(Line(x1, y1, x2, y2, parseFillMode(fill), ColorPalette::instance().intern(color)));
+    }
+
+    // Show a frame on the terminal, from the calling thread. std::cout is
+    // never touched here: the render thread calls this too, and drawBoard
+    // flushes it beforehand on the command thread.
+    void present(const FrameView& view) {
+        if (headless) return;
+        if (terminal && terminal->present(view)) return;
+
+        // Encode the whole frame, then hand it to the terminal in one write
+        encoder.encode(view);
+        encoder.writeTo(STDOUT_FILENO);
+    }
+
+    // Render thread side: copy the current frame and present the copy
+    void presentSnapshot() {
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            if (snapshot.getWidth() != frame.getWidth() || snapshot.getHeight() != frame.getHeight()) {
+                snapshot = Framebuffer(frame.getWidth(), frame.getHeight());
+            }
+            FrameView from = frame.view();
+            std::memcpy(snapshot.view().data, from.data, from.stride * (from.height - 1) + from.width);
+        }
+        present(snapshot.view());
+    }
+
+    // Render the current frame into a caller-supplied buffer of
+    // ImageEncoder::imageBytes() bytes, without a header. Returns false if
+    // the scale is out of range or the buffer is too small.
+    bool renderImage(std::span<uint8_t> pixels, ImageFormat format, int scale = 1) {
+        if (scale < 1 || scale > ImageEncoder::MAX_SCALE) return false;
+        refresh();
+        std::lock_guard<std::mutex> lock(frameMutex);
+        FrameView view = frame.view();
+        size_t rowBytes = ImageEncoder::rowBytes(view.width, scale, format);
+        if (pixels.size() < rowBytes * view.height * scale) return false;
+
+        uint8_t* out = pixels.data();
+        for (int y = 0; y < view.height; ++y) {
+            ImageEncoder::encodeRow(view.row(y), view.width, scale, format, out);
+            for (int i = 1; i < scale; ++i) {
+                std::memcpy(out + rowBytes * i, out, rowBytes);
+            }
+            out += rowBytes * scale;
+        }
+        return true;
+    }
+
+    // Write the current frame as a PPM image, or PGM if the file name ends
+    // in ".pgm". Only one row of pixels is held in memory at a time.
+    void render(const std::string& filename, int scale) {
+        if (scale < 1 || scale > ImageEncoder::MAX_SCALE) {
+            std::cerr << "Error: render scale must be between 1 and " << ImageEncoder::MAX_SCALE << ".\n";
+            return;
+        }
+        std::ofstream outFile(filename, std::ios::out | std::ios::binary);
+        if (!outFile) {
+            std::cerr << "Error opening file for rendering.\n";
+            return;
+        }
+        bool grey = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".pgm") == 0;
+        ImageFormat format = grey ? ImageFormat::PGM : ImageFormat::PPM;
+
+        refresh();
+        std::lock_guard<std::mutex> lock(frameMutex);
+        FrameView view = frame.view();
+        outFile << ImageEncoder::header(view.width, view.height, scale, format);
+        std::vector<uint8_t> row(ImageEncoder::rowBytes(view.width, scale, format));
+        for (int y = 0; y < view.height; ++y) {
+            ImageEncoder::encodeRow(view.row(y), view.width, scale, format, row.data());
+            for (int i = 0; i < scale; ++i) {
+                outFile.write(reinterpret_cast<const char*>(row.data()), row.size());
+            }
+        }
+        if (!outFile) {
+            std::cerr << "Error writing " << filename << ".\n";
+            return;
+        }
+        confirm() << "Blackboard rendered to " << filename << ".\n";
+    }
+
+    // Method to draw all shapes on the board
+    void drawBoard() {
+        refresh();
+        std::cout.flush(); // Keep the frame after anything already printed
+        if (renderThread) {
+            renderThread->request(); // Shown by the render thread, coalesced with other requests
+        } else {
+            present(frame.view());
+        }
+    }
+
+    void clear() {
+        std::vector<PlacedShape> before;
+        bool recording = copyShapes(before);
+        clearShapes();
+        if (journaling()) {
+            payload();
+            log(Journal::CLEAR);
+        }
+        if (recording) recordReplacement("clear", std::move(before), getWidth(), getHeight());
+    }
+
+    void clearShapes() {
+        shapes.clear(); // Every handle in handlesByID goes stale
+        deselect();
+        tiles.clear();
+        std::lock_guard<std::mutex> lock(frameMutex);
+        frame.view().clear(' '); // Fill every cell with empty spaces
+        std::fill(pickCells.begin(), pickCells.end(), 0);
+    }
+
+    void showShapesList() {
+        for (const PlacedShape* placed : inDrawOrder()) {
+            auto [type, x, y, param1, param2, fillType, color] = parametersOf(placed->shape);
+            std::cout << "ID: " << shapeOf(placed->shape).getID() << " | Type: " << type
                       << " | Position: (" << x << ", " << y << ") "
                       << " | Fill Type:" << fillType << " | Color:" << color;
             if (type == "Circle") {
@@ -618,30 +2794,210 @@ public:
                 std::cout << " | Width: " << param1 << " | Height: " << param2;
             }
             // Handle other shapes similarly
-            std::cout << std::endl;
+            std::cout << "\n";
+        }
+    }
+
+    static void availableShapes() {
+        std::cout << "Triangle: fill, color, coordinates, height\n";
+        std::cout << "Circle: fill, color, coordinates, radius\n";
+        std::cout << "Rectangle: fill, color, coordinates, height, width\n";
+        std::cout << "Line: fill, color, start coordinates, end coordinates\n";
+    }
+
+    // Revert the last command: add, remove, move, paint, edit, clear, new or load
+    void undo() {
+        size_t position = history.position();
+        if (position == history.oldest()) {
+            std::cout << "Nothing to undo.\n";
+            return;
+        }
+        travelTo(position - 1);
+        confirm() << "Undid " << history.entry(position).description << ".\n";
+        if (!quiet) drawBoard();  // Redraw the board as it was
+    }
+
+    void redo() {
+        size_t position = history.position();
+        if (position == history.newest()) {
+            std::cout << "Nothing to redo.\n";
+            return;
+        }
+        travelTo(position + 1);
+        confirm() << "Redid " << history.entry(position + 1).description << ".\n";
+        if (!quiet) drawBoard();
+    }
+
+    // Undo or redo every command up to a position in the history
+    void goTo(size_t position) {
+        if (position < history.oldest() || position > history.newest()) {
+            std::cout << "Error: history position must be between " << history.oldest() << " and " << history.newest() << ".\n";
+            return;
+        }
+        travelTo(position);
+        confirm() << "Board is at history position " << position << ".\n";
+        if (!quiet) drawBoard();
+    }
+
+    // List the commands that can be undone and redone, marking the board's position
+    void showHistory() const {
+        for (size_t n = history.oldest(); n <= history.newest(); ++n) {
+            std::cout << (n == history.position() ? "* " : "  ") << n << ": "
+                      << (n == 0 ? "start" : n == history.oldest() ? "(earlier commands forgotten)" : history.entry(n).description) << "\n";
+        }
+        std::cout << "History uses " << (history.bytesUsed() + 1023) / 1024 << " KiB.\n";
+    }
+
+    // Cap the memory the undo history may use, forgetting the oldest commands past it
+    void setHistoryBudget(size_t bytes) {
+        history.setBudget(bytes);
+    }
+
+    // Write the shapes in the binary scene format, streaming the records in
+    // fixed-size chunks
+    void saveBinary(const std::string& filename) {
+        std::ofstream outFile(filename, std::ios::out | std::ios::binary);
+        if (!outFile) {
+            std::cout << "Error opening file for saving.\n";
+            return;
+        }
+
+        // The string table holds only the colours the shapes use, in order of
+        // first use; fileColors maps palette indices to table indices
+        ColorPalette& palette = ColorPalette::instance();
+        std::vector<const PlacedShape*> ordered = inDrawOrder();
+        std::vector<int> fileColors(palette.size(), -1);
+        std::string strings;
+        int fileColorCount = 0;
+        for (const PlacedShape* placed : ordered) {
+            uint16_t color = shapeOf(placed->shape).getColorIndex();
+            if (fileColors[color] < 0) {
+                fileColors[color] = fileColorCount++;
+                strings += palette.name(color);
+                strings += '\0';
+            }
+        }
+
+        uint8_t header[SceneFormat::HEADER_SIZE] = {};
+        std::memcpy(header, SceneFormat::MAGIC, sizeof(SceneFormat::MAGIC));
+        SceneFormat::store32(header + 8, SceneFormat::VERSION);
+        SceneFormat::store32(header + 12, SceneFormat::RECORD_SIZE);
+        SceneFormat::store64(header + 16, ordered.size());
+        SceneFormat::store64(header + 24, strings.size());
+        outFile.write(reinterpret_cast<const char*>(header), sizeof(header)); // Checksum filled in last
+
+        // 4096 records are a multiple of 8 bytes, so the checksum can run per chunk
+        const size_t CHUNK = 4096;
+        std::vector<uint8_t> chunk(CHUNK * SceneFormat::RECORD_SIZE);
+        uint64_t checksum = 0x9E3779B97F4A7C15ull;
+        for (size_t first = 0; first < ordered.size(); first += CHUNK) {
+            size_t count = std::min(CHUNK, ordered.size() - first);
+            for (size_t i = 0; i < count; ++i) {
+                const ShapeRecord& record = ordered[first + i]->shape;
+                auto params = parametersOf(record);
+                uint8_t* out = chunk.data() + i * SceneFormat::RECORD_SIZE;
+                out[0] = static_cast<uint8_t>(record.index());
+                out[1] = static_cast<uint8_t>(shapeOf(record).getFillMode());
+                SceneFormat::store16(out + 2, static_cast<uint16_t>(fileColors[shapeOf(record).getColorIndex()]));
+                SceneFormat::store32(out + 4, std::get<1>(params));
+                SceneFormat::store32(out + 8, std::get<2>(params));
+                SceneFormat::store32(out + 12, std::get<3>(params));
+                SceneFormat::store32(out + 16, std::get<4>(params));
+            }
+            size_t bytes = count * SceneFormat::RECORD_SIZE;
+            checksum = SceneFormat::checksum(chunk.data(), bytes, checksum);
+            outFile.write(reinterpret_cast<const char*>(chunk.data()), bytes);
+        }
+        checksum = SceneFormat::checksum(reinterpret_cast<const uint8_t*>(strings.data()), strings.size(), checksum);
+        outFile.write(strings.data(), strings.size());
+
+        SceneFormat::store64(header + 32, checksum);
+        outFile.seekp(32);
+        outFile.write(reinterpret_cast<const char*>(header + 32), 8);
+        if (!outFile) {
+            std::cout << "Error writing " << filename << ".\n";
+            return;
+        }
+        confirm() << "Blackboard saved to " << filename << ".\n";
+    }
+
+    // Replace the shapes with those of a mapped binary scene. The whole file
+    // is validated before the board is touched; returns false if it is not.
+    bool loadBinary(const MappedFile& file, const std::string& filename) {
+        const uint8_t* data = file.data();
+        size_t size = file.size();
+        auto invalid = [&filename](const char* reason) {
+            std::cout << "Error: " << filename << " is not a valid scene file (" << reason << ").\n";
+            return false;
+        };
+
+        if (size < SceneFormat::HEADER_SIZE) return invalid("truncated header");
+        if (SceneFormat::load32(data + 8) != SceneFormat::VERSION) return invalid("unsupported version");
+        if (SceneFormat::load32(data + 12) != SceneFormat::RECORD_SIZE) return invalid("unexpected record size");
+        uint64_t count = SceneFormat::load64(data + 16);
+        uint64_t stringsSize = SceneFormat::load64(data + 24);
+        size_t body = size - SceneFormat::HEADER_SIZE;
+        if (count > body / SceneFormat::RECORD_SIZE || stringsSize != body - count * SceneFormat::RECORD_SIZE) {
+            return invalid("sizes do not match the file");
+        }
+        const uint8_t* records = data + SceneFormat::HEADER_SIZE;
+        const char* strings = reinterpret_cast<const char*>(records + count * SceneFormat::RECORD_SIZE);
+        uint64_t checksum = SceneFormat::checksum(records, count * SceneFormat::RECORD_SIZE);
+        checksum = SceneFormat::checksum(reinterpret_cast<const uint8_t*>(strings), stringsSize, checksum);
+        if (checksum != SceneFormat::load64(data + 32)) {
+            return invalid("checksum mismatch");
         }
-    }
 
-    static void availableShapes() {
-        std::cout << "Triangle: fill, color, coordinates, height\n";
-        std::cout << "Circle: fill, color, coordinates, radius\n";
-        std::cout << "Rectangle: fill, color, coordinates, height, width\n";
-        std::cout << "Line: fill, color, start coordinates, end coordinates\n";
-    }
+        // Intern the colour names, mapping file indices to palette indices
+        std::vector<uint16_t> colors;
+        for (size_t at = 0; at < stringsSize;) {
+            const void* end = std::memchr(strings + at, '\0', stringsSize - at);
+            if (!end || colors.size() == ColorPalette::CAPACITY) return invalid("bad string table");
+            size_t length = static_cast<const char*>(end) - (strings + at);
+            colors.push_back(ColorPalette::instance().intern(std::string_view(strings + at, length)));
+            at += length + 1;
+        }
 
-    void undo() {
-        if (!shapes.empty()) {
-            shapes.pop_back();  // Remove the last added shape
-            shapesParams.pop_back();  // Remove its parameters
-            undoClear();
-            std::cout << "Last shape removed from the board.\n";
-            drawBoard();  // Redraw the board with remaining shapes
-        } else {
-            std::cout << "No shapes to remove.\n";
+        for (uint64_t i = 0; i < count; ++i) {
+            const uint8_t* record = records + i * SceneFormat::RECORD_SIZE;
+            if (record[0] > SceneFormat::LINE || record[1] > static_cast<uint8_t>(FillMode::Fill) ||
+                SceneFormat::load16(record + 2) >= colors.size()) {
+                return invalid("bad shape record");
+            }
+        }
+
+        clearShapes();
+        shapes.reserve(shapes.size() + count);
+        handlesByID.reserve(handlesByID.size() + count);
+        for (uint64_t i = 0; i < count; ++i) {
+            const uint8_t* record = records + i * SceneFormat::RECORD_SIZE;
+            FillMode fill = static_cast<FillMode>(record[1]);
+            uint16_t color = colors[SceneFormat::load16(record + 2)];
+            int x = static_cast<int32_t>(SceneFormat::load32(record + 4));
+            int y = static_cast<int32_t>(SceneFormat::load32(record + 8));
+            int param1 = static_cast<int32_t>(SceneFormat::load32(record + 12));
+            int param2 = static_cast<int32_t>(SceneFormat::load32(record + 16));
+            addShape(makeShape(record[0], x, y, param1, param2, fill, color));
         }
+        confirm() << "Blackboard loaded from " << filename << " (" << count << " shapes).\n";
+        return true;
     }
 
+    // Saves as a binary scene when the file name ends in ".bin", as text otherwise.
+    // Without a file name, makes everything journaled so far durable
     void save(const std::string& filename) {
+        if (filename.empty() && journal) {
+            if (!journal->commit()) {
+                stopJournal();
+                return;
+            }
+            confirm() << "Blackboard saved to " << journal->getPath() << " (journal).\n";
+            return;
+        }
+        if (filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".bin") == 0) {
+            saveBinary(filename);
+            return;
+        }
         std::ofstream outFile(filename, std::ios::out);
         if (!outFile) {
             std::cout << "Error opening file for saving.\n";
@@ -649,8 +3005,8 @@ public:
         }
 
         // Save each shape's parameters
-        for (const auto& shape : shapes) {
-            auto params = shape->getParameters();
+        for (const PlacedShape* placed : inDrawOrder()) {
+            auto params = parametersOf(placed->shape);
             std::string type = std::get<0>(params);
             int x = std::get<1>(params);
             int y = std::get<2>(params);
@@ -665,135 +3021,325 @@ public:
         }
 
         outFile.close();
-        std::cout << "Blackboard saved to " << filename << ".\n";
+        confirm() << "Blackboard saved to " << filename << ".\n";
+    }
+
+    // Text scenes at least this large are parsed on several threads
+    static const size_t PARALLEL_LOAD_MIN_BYTES = 4 << 20;
+
+    // A shape parsed from text, with its colour still local to its chunk
+    struct ParsedShape {
+        uint8_t kind;
+        FillMode fill;
+        uint16_t color; // Index into the chunk's colour names
+        int x, y, param1, param2;
+    };
+
+    struct ParsedChunk {
+        std::vector<ParsedShape> shapes;
+        std::vector<std::string_view> colors;
+        size_t stoppedAt = std::string_view::npos; // Start of the first line not parsed, if any
+    };
+
+    static ShapeRecord makeShape(uint8_t kind, int x, int y, int param1, int param2, FillMode fill, uint16_t color) {
+        switch (kind) {
+            case SceneFormat::CIRCLE: return Circle(x, y, param1, fill, color);
+            case SceneFormat::RECTANGLE: return Rectangle(x, y, param1, param2, fill, color);
+            case SceneFormat::TRIANGLE: return Triangle(x, y, param1, fill, color);
+            default: return Line(x, y, param1, param2, fill, color);
+        }
+    }
+
+    // A whole token as an int; a leading '+' is accepted, as by operator>>
+    static bool parseInt(std::string_view token, int& value) {
+        if (!token.empty() && token[0] == '+') token.remove_prefix(1);
+        auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+        return result.ec == std::errc() && result.ptr == token.data() + token.size();
+    }
+
+    static bool isSpace(char c) {
+        return std::isspace(static_cast<unsigned char>(c));
+    }
+
+    // Add the shapes of the text save format: whitespace-separated
+    // "type x y param1 param2 fill color" groups, as read by operator>>
+    // before. Reading stops at the first group that does not parse; unknown
+    // types are skipped. Returns the number of shapes added.
+    size_t addSequential(std::string_view text) {
+        size_t at = 0;
+        auto nextToken = [&]() -> std::string_view {
+            while (at < text.size() && isSpace(text[at])) ++at;
+            size_t start = at;
+            while (at < text.size() && !isSpace(text[at])) ++at;
+            return text.substr(start, at - start);
+        };
+
+        ColorPalette& palette = ColorPalette::instance();
+        size_t loaded = 0;
+        while (true) {
+            std::string_view type = nextToken();
+            int x, y, param1, param2;
+            if (type.empty() || !parseInt(nextToken(), x) || !parseInt(nextToken(), y) ||
+                !parseInt(nextToken(), param1) || !parseInt(nextToken(), param2)) {
+                break;
+            }
+            std::string_view fill = nextToken();
+            std::string_view color = nextToken();
+            if (color.empty()) break;
+
+            SceneFormat::Kind kind;
+            if (!SceneFormat::kindFromName(type, kind)) continue;
+            addShape(makeShape(kind, x, y, param1, param2, parseFillMode(fill), palette.intern(color)));
+            ++loaded;
+        }
+        return loaded;
+    }
+
+    // Parse the lines in [begin, end) of a text scene, one shape per line as
+    // saved. Parsing stops at the first line that is not exactly one
+    // well-formed group, or that would need more chunk colour indices than
+    // fit a uint16_t, so the caller can resume there sequentially.
+    static void parseChunk(std::string_view text, size_t begin, size_t end, ParsedChunk& chunk) {
+        std::unordered_map<std::string_view, uint16_t> colorIndices;
+        size_t at = begin;
+        while (at < end) {
+            size_t lineEnd = std::min(text.find('\n', at), end);
+
+            std::string_view fields[7];
+            int count = 0;
+            for (size_t i = at; i < lineEnd;) {
+                while (i < lineEnd && isSpace(text[i])) ++i;
+                if (i == lineEnd) break;
+                size_t start = i;
+                while (i < lineEnd && !isSpace(text[i])) ++i;
+                if (count == 7) {
+                    count = -1; // More than one group on the line
+                    break;
+                }
+                fields[count++] = text.substr(start, i - start);
+            }
+
+            ParsedShape shape;
+            if (count != 0) {
+                if (count != 7 || !parseInt(fields[1], shape.x) || !parseInt(fields[2], shape.y) ||
+                    !parseInt(fields[3], shape.param1) || !parseInt(fields[4], shape.param2)) {
+                    chunk.stoppedAt = at;
+                    return;
+                }
+                SceneFormat::Kind kind;
+                if (SceneFormat::kindFromName(fields[0], kind)) {
+                    shape.kind = kind;
+                    shape.fill = parseFillMode(fields[5]);
+                    auto it = colorIndices.find(fields[6]);
+                    if (it == colorIndices.end()) {
+                        if (chunk.colors.size() == ColorPalette::CAPACITY) {
+                            chunk.stoppedAt = at; // Out of chunk indices: leave the rest to the sequential path
+                            return;
+                        }
+                        it = colorIndices.emplace(fields[6], static_cast<uint16_t>(chunk.colors.size())).first;
+                        chunk.colors.push_back(fields[6]);
+                    }
+                    shape.color = it->second;
+                    chunk.shapes.push_back(shape);
+                }
+            }
+            at = lineEnd + 1;
+        }
+    }
+
+    // Parse newline-aligned chunks of a text scene on one thread per core,
+    // then add the shapes in file order, so IDs and draw order are those a
+    // sequential load gives. Returns the number of shapes added.
+    size_t addParallel(std::string_view text) {
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        size_t chunkBytes = std::max<size_t>(1 << 20, text.size() / (threads * 4));
+
+        std::vector<size_t> bounds{0};
+        while (bounds.back() < text.size()) {
+            size_t next = bounds.back() + chunkBytes;
+            next = next >= text.size() ? text.size() : std::min(text.find('\n', next), text.size() - 1) + 1;
+            bounds.push_back(next);
+        }
+
+        std::vector<ParsedChunk> chunks(bounds.size() - 1);
+        std::atomic<size_t> nextChunk{0};
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < std::min<size_t>(threads, chunks.size()); ++i) {
+            workers.emplace_back([&] {
+                for (size_t chunk; (chunk = nextChunk++) < chunks.size();) {
+                    parseChunk(text, bounds[chunk], bounds[chunk + 1], chunks[chunk]);
+                }
+            });
+        }
+        for (std::thread& worker : workers) worker.join();
+
+        ColorPalette& palette = ColorPalette::instance();
+        size_t loaded = 0;
+        for (const ParsedChunk& chunk : chunks) {
+            std::vector<uint16_t> colors;
+            for (std::string_view name : chunk.colors) colors.push_back(palette.intern(name));
+            for (const ParsedShape& shape : chunk.shapes) {
+                addShape(makeShape(shape.kind, shape.x, shape.y, shape.param1, shape.param2, shape.fill, colors[shape.color]));
+            }
+            loaded += chunk.shapes.size();
+            if (chunk.stoppedAt != std::string_view::npos) {
+                // Irregular input from here on: finish it exactly as a sequential load would
+                loaded += addSequential(text.substr(chunk.stoppedAt));
+                break;
+            }
+        }
+        return loaded;
+    }
+
+    // Replace the shapes with those of a text scene held in memory
+    void loadText(std::string_view text, const std::string& filename) {
+        // One shape per line in saved files
+        clearShapes();
+        size_t lines = std::count(text.begin(), text.end(), '\n');
+        shapes.reserve(lines);
+        handlesByID.reserve(handlesByID.size() + lines);
+
+        size_t loaded = text.size() >= PARALLEL_LOAD_MIN_BYTES ? addParallel(text) : addSequential(text);
+        confirm() << "Blackboard loaded from " << filename << " (" << loaded << " shapes).\n";
     }
 
     void load(const std::string& filename) {
-        // Open file in read mode
-        std::ifstream inFile(filename);
-        if (!inFile.is_open()) {
+        // The journal takes the loaded scene as one snapshot and the history
+        // as one command, not shape by shape
+        std::vector<PlacedShape> before;
+        bool recording = copyShapes(before);
+        bool muted = journalMuted;
+        journalMuted = historyMuted = true;
+        bool replaced = loadScene(filename);
+        journalMuted = muted;
+        historyMuted = false; // Never loading while muted
+        if (!replaced) return;
+        if (journaling()) compactJournal();
+        if (recording) recordReplacement("load " + filename, std::move(before), getWidth(), getHeight());
+    }
+
+    // Returns false if the board was left as it was
+    bool loadScene(const std::string& filename) {
+        // The whole file is mapped and parsed in place
+        MappedFile mapped;
+        if (!mapped.open(filename)) {
+            if (std::ifstream(filename).is_open()) {
+                loadText({}, filename); // An empty scene
+                return true;
+            }
             std::cout << "File not found. Creating a new file: " << filename << ".\n";
             std::ofstream outFile(filename);  // Create new file
             outFile.close();
-            return;
+            return false;
         }
 
-        // Clear the current board and shapes
-        clear();
-
-        std::string type, fill, color;
-        int x, y, param1, param2;
-
-        // Load each shape from the file and add to the board
-        while (inFile >> type >> x >> y >> param1 >> param2 >> fill >> color) {
-            std::cout << "Loaded shape: " << type << " at (" << x << ", " << y << ") with params: " << param1 << " " << param2 << "\n";
-            if (type == "Triangle") {
-                // inFile >> x >> y >> param1;
-                // std::shared_ptr<Shape> triangle = std::make_shared<Triangle>(x, y, param1);
-                addTriangle(x, y, param1, fill, color);
-            } else if (type == "Circle") {
-                // inFile >> x >> y >> param1;
-                // std::shared_ptr<Shape> circle = std::make_shared<Circle>(x, y, param1);
-                addCircle(x, y, param1, fill, color);
-            } else if (type == "Rectangle") {
-                // inFile >> x >> y >> param1 >> param2;
-                // std::shared_ptr<Shape> rectangle = std::make_shared<Rectangle>(x, y, param1, param2);
-                addRectangle(x, y, param1, param2, fill, color);
-            } else if (type == "Line") {
-                // inFile >> x >> y >> param1 >> param2 >> fill >> color;
-                // std::shared_ptr<Shape> line = std::make_shared<Line>(x, y, param1, param2);
-                addLine(x, y, param1, param2, fill, color);
+        // Binary scenes are recognised by their magic, whatever their name
+        if (mapped.size() >= sizeof(SceneFormat::MAGIC) &&
+            std::memcmp(mapped.data(), SceneFormat::MAGIC, sizeof(SceneFormat::MAGIC)) == 0) {
+            return loadBinary(mapped, filename);
+        }
+        loadText({reinterpret_cast<const char*>(mapped.data()), mapped.size()}, filename);
+        return true;
+    }
+
+    // Hit-test every point at once: outIds[i] receives the ID of the topmost
+    // shape drawn on points[i], or -1, exactly as selectByCoordinates would
+    // pick it. The frame is brought up to date once for the whole batch, so
+    // on-board points cost one pick-buffer load each where the board has one.
+    void hitTestBatch(std::span<const Point> points, std::span<int> outIds) {
+        bool buffered = usesPickBuffer();
+        if (buffered) {
+            enablePicking();
+            refresh();
+        }
+        const int width = getWidth(), height = getHeight();
+        size_t count = std::min(points.size(), outIds.size());
+        for (size_t i = 0; i < count; ++i) {
+            Point point = points[i];
+            if (buffered && point.x >= 0 && point.x < width && point.y >= 0 && point.y < height) {
+                uint32_t id = pickCells[static_cast<size_t>(point.y) * width + point.x];
+                outIds[i] = id ? static_cast<int>(id) : -1;
+            } else {
+                const PlacedShape* hit = topmostAt(point.x, point.y);
+                outIds[i] = hit ? shapeOf(hit->shape).getID() : -1;
             }
         }
-
-        inFile.close();
-        std::cout << "Blackboard loaded from " << filename << ".\n";
     }
 
-    void select(const std::string& input) {
-        std::istringstream iss(input);
-        std::vector<std::string> tokens;
-        std::string token;
+    // Hit-test the "x y" points listed in a file and print the shape under each
+    void pick(const std::string& filename) {
+        std::ifstream inFile(filename);
+        if (!inFile.is_open()) {
+            std::cout << "Error opening file for picking.\n";
+            return;
+        }
 
-        // Tokenize the input based on whitespace
-        while (iss >> token) {
-            tokens.push_back(token);
+        std::vector<Point> points;
+        Point point;
+        while (inFile >> point.x >> point.y) {
+            points.push_back(point);
         }
 
-        if (tokens.size() == 1) {
-            // One argument, treat it as an ID
-            selectByID(std::stoi(tokens[0]));
-        } else if (tokens.size() == 2) {
-            // Two arguments, treat them as coordinates
-            int x = std::stoi(tokens[0]);
-            int y = std::stoi(tokens[1]);
-            selectByCoordinates(x, y);
-        } else {
-            std::cout << "Invalid input. Use 'select <id>' or 'select <x> <y>'.\n";
+        std::vector<int> ids(points.size());
+        hitTestBatch(points, ids);
+
+        size_t hits = 0;
+        for (size_t i = 0; i < points.size(); ++i) {
+            std::cout << "(" << points[i].x << ", " << points[i].y << "): ";
+            if (ids[i] == -1) {
+                std::cout << "none\n";
+            } else {
+                std::cout << "ID " << ids[i] << "\n";
+                ++hits;
+            }
         }
+        confirm() << "Picked " << points.size() << " points, " << hits << " on shapes.\n";
     }
 
     // Method to select a shape by ID
     void selectByID(int id) {
-        bool found = false;
-        for (const auto& params : shapesParams) {
-            if (std::get<0>(params) == id) {
-                selectedShapeID = id;
-                printShapeInfo(params);
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
+        if (const PlacedShape* placed = findByID(id)) {
+            setSelection(id);
+            printShapeInfo(placed->shape);
+        } else {
             std::cout << "Shape with ID " << id << " not found.\n";
         }
     }
 
     // Method to select a shape by coordinates
     void selectByCoordinates(int px, int py) {
-        bool found = false;
-        for (int i = shapes.size() - 1; i >= 0; --i) {
-            if (shapes[i]->containsPoint(px, py)) {
-                selectedShapeID = std::get<0>(shapesParams[i]);
-                printShapeInfo(shapesParams[i]);
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
+        // The topmost shape containing the point wins
+        if (const PlacedShape* hit = topmostAt(px, py)) {
+            setSelection(shapeOf(hit->shape).getID());
+            printShapeInfo(hit->shape);
+        } else {
             std::cout << "No shape occupies the point (" << px << ", " << py << ").\n";
         }
     }
 
 
     // for select method
-    static void printShapeInfo(const std::tuple<int, std::string, int, int, int, int, std::string, std::string>& params) {
-        int id = std::get<0>(params);
-        std::string shapeType = std::get<1>(params);
-        int x = std::get<2>(params);
-        int y = std::get<3>(params);
-        int param1 = std::get<4>(params);
-        int param2 = std::get<5>(params);
-        std::string fillType = std::get<6>(params);
-        std::string color = std::get<7>(params);
-
-        std::cout << "Selected Shape ID: " << id
+    void printShapeInfo(const ShapeRecord& shape) {
+        int id = shapeOf(shape).getID();
+        auto [shapeType, x, y, param1, param2, fillType, color] = parametersOf(shape);
+
+        confirm() << "Selected Shape ID: " << id
                 <<", Type: " << shapeType
                 << ", Position: (" << x << ", " << y << ")"
                 << ", Fill Type: " << fillType
                 << ", Color: " << color;
 
         if (shapeType == "Triangle") {
-            std::cout << ", Height: " << param1 << "\n";
+            confirm() << ", Height: " << param1 << "\n";
         }
         else if (shapeType == "Circle") {
-            std::cout << ", Radius: " << param1 << "\n";
+            confirm() << ", Radius: " << param1 << "\n";
         }
         else if (shapeType == "Rectangle") {
-            std::cout << ", Width: " << param1 << ", Height: " << param2 << "\n";
+            confirm() << ", Width: " << param1 << ", Height: " << param2 << "\n";
         }
         else if (shapeType == "Line") {
-            std::cout << ", End X: " << param1 << ", End Y: " << param2 << "\n";
+            confirm() << ", End X: " << param1 << ", End Y: " << param2 << "\n";
         }
     }
 
@@ -803,41 +3349,45 @@ public:
             return;
         }
 
-        bool found = false;
-        for (int i = 0; i < shapesParams.size(); ++i) {
-            if (std::get<0>(shapesParams[i]) == selectedShapeID) {
-                shapesParams.erase(shapesParams.begin() + i);
-                shapes.erase(shapes.begin() + i); // Remove the shape from the shapes vector
-                std::cout << "Shape with ID " << selectedShapeID << " removed successfully.\n";
-                selectedShapeID = -1; // Reset the selected shape ID
-                found = true;
-                break;
+        if (const PlacedShape* placed = shapes.get(selected)) {
+            PlacedShape before = *placed;
+            erase(selected); // O(1): the last shape fills the hole in the slot map
+            if (journaling()) {
+                payload().int32(selectedShapeID);
+                log(Journal::REMOVE);
             }
-        }
-
-        if (!found) {
+            if (!historyMuted) {
+                recordChange("remove " + std::get<0>(parametersOf(before.shape)) + " " + std::to_string(selectedShapeID),
+                             selectedShapeID, std::move(before), std::nullopt);
+            }
+            confirm() << "Shape with ID " << selectedShapeID << " removed successfully.\n";
+            deselect(); // Reset the selected shape ID
+        } else {
             std::cout << "Shape with ID " << selectedShapeID << " not found.\n";
         }
     }
 
-    void paint(const std::string& newColor) {
+    void paint(std::string_view newColor) {
         if (selectedShapeID == -1) {
             std::cout << "No shape is selected. Please select a shape first.\n";
             return;
         }
 
-        bool found = false;
-        for (auto& shape : shapes) {
-            if (shape->getID() == selectedShapeID) {
-                shape->setColor(newColor);
-                std::string shapeType = std::get<1>(shapesParams[selectedShapeID - 1]);
-                std::cout << "ID: " << selectedShapeID << " Shape: " << shapeType << " Color: " << newColor << "\n";
-                found = true;
-                break;
+        if (PlacedShape* placed = shapes.get(selected)) {
+            PlacedShape before = *placed;
+            shapeOf(placed->shape).setColor(newColor);
+            tiles.damage(boundsOf(placed->shape));
+            if (journaling()) {
+                payload().int32(selectedShapeID).text(newColor);
+                log(Journal::PAINT);
             }
-        }
-
-        if (!found) {
+            std::string shapeType = std::get<0>(parametersOf(placed->shape));
+            if (!historyMuted) {
+                recordChange("paint " + shapeType + " " + std::to_string(selectedShapeID) + " " + std::string(newColor),
+                             selectedShapeID, std::move(before), *placed);
+            }
+            confirm() << "ID: " << selectedShapeID << " Shape: " << shapeType << " Color: " << newColor << "\n";
+        } else {
             std::cout << "Shape with ID " << selectedShapeID << " not found.\n";
         }
     }
@@ -848,289 +3398,563 @@ public:
             return;
         }
 
-        bool found = false;
-
-        // Find the selected shape
-        for (size_t i = 0; i < shapes.size(); ++i) {
-            if (std::get<0>(shapesParams[i]) == selectedShapeID) {
-                found = true;
-
-                // Move the shape to the new position
-                auto shape = shapes[i];
-                auto& params = shapesParams[i];
-
-                if (newX < 0 || newX >= BOARD_WIDTH || newY < 0 || newY >= BOARD_HEIGHT) {
-                    std::cout << "Error: Shape will go out of the board boundaries.\n";
-                    return;
-                }
-
-                // Set new position for the shape
-                shape->setX(newX);
-                shape->setY(newY);
-
-                // Update the parameters in shapesParams for the new position
-                std::get<2>(params) = newX;
-                std::get<3>(params) = newY;
-
-                // // Bring the shape to the foreground by moving it to the end of the list
-                // shapes.erase(shapes.begin() + i);  // Remove shape from current position
-                // shapesParams.erase(shapesParams.begin() + i); // Remove corresponding params
-
-                shapes.push_back(shape);  // Add shape to the end
-                shapesParams.push_back(params);  // Add params to the end
-
-                // Use shape type from params
-                std::string shapeType = std::get<1>(params);
+        if (PlacedShape* placed = shapes.get(selected)) {
+            if (newX < 0 || newX >= getWidth() || newY < 0 || newY >= getHeight()) {
+                std::cout << "Error: Shape will go out of the board boundaries.\n";
+                return;
+            }
 
-                // Output the move message
-                std::cout << selectedShapeID << " " << shapeType << " moved to (" << newX << ", " << newY << ").\n";
+            // The shape comes to the foreground with the highest draw order;
+            // taken first, as it may renumber every draw order
+            unsigned drawOrder = takeDrawOrder();
+
+            // Set new position for the shape, damaging the cells it leaves
+            PlacedShape before = *placed;
+            tiles.remove(placed->drawOrder, boundsOf(placed->shape));
+            std::visit([newX, newY](auto& s) { s.move(newX, newY); }, placed->shape);
+            placed->drawOrder = drawOrder;
+            tiles.insert(placed->drawOrder, selected.index, boundsOf(placed->shape));
+            if (journaling()) {
+                payload().int32(selectedShapeID).int32(newX).int32(newY);
+                log(Journal::MOVE);
+            }
 
-                break;
+            // Use shape type from its parameters
+            std::string shapeType = std::get<0>(parametersOf(placed->shape));
+            if (!historyMuted) {
+                recordChange("move " + shapeType + " " + std::to_string(selectedShapeID) + " to (" + std::to_string(newX) + ", " +
+                             std::to_string(newY) + ")", selectedShapeID, std::move(before), *placed);
             }
-        }
 
-        if (!found) {
+            // Output the move message
+            confirm() << selectedShapeID << " " << shapeType << " moved to (" << newX << ", " << newY << ").\n";
+        } else {
             std::cout << "Shape with ID " << selectedShapeID << " not found.\n";
         }
     }
 
 
     void moveToForeground() {
-        if (selectedShapeID != -1) {
-            for (const auto& shape : shapes) {
-                if (shape->getID() == selectedShapeID) {
-                    // Use getParameters to retrieve current position (x, y)
-                    auto params = shape->getParameters();
-                    int x = std::get<1>(params);  // Assuming x is the second element in the tuple
-                    int y = std::get<2>(params);  // Assuming y is the third element in the tuple
-
-                    // Call move to bring the shape to the foreground without changing its position
-                    move(x, y);
-                    break;
-                }
-            }
+        if (const PlacedShape* placed = shapes.get(selected)) {
+            // Use getParameters to retrieve current position (x, y)
+            auto params = parametersOf(placed->shape);
+            int x = std::get<1>(params);  // Assuming x is the second element in the tuple
+            int y = std::get<2>(params);  // Assuming y is the third element in the tuple
+
+            // Call move to bring the shape to the foreground without changing its position
+            move(x, y);
         }
     }
 
     void edit(int new_size1, int new_size2 = -1) {
     if (selectedShapeID == -1) {
-        std::cout << "Error: No shape selected." << std::endl;
+        std::cout << "Error: No shape selected.\n";
         return;
     }
 
-    // Iterate through the shapes to find the selected shape
-    for (size_t i = 0; i < shapes.size(); ++i) {
-        if (shapes[i]->getID() == selectedShapeID) {
-            // Get current position and parameters of the selected shape
-            auto [shapeType, x, y, param1, param2, fill, color] = shapes[i]->getParameters();
-
-            // Circle case: Modify radius and check boundary
-            if (auto circle = dynamic_cast<Circle*>(shapes[i].get())) {
-                int radius = new_size1;
-                if (x - radius < 0 || x + radius > BOARD_WIDTH || y - radius < 0 || y + radius > BOARD_HEIGHT) {
-                    std::cout << "Error: Shape will go out of the board." << std::endl;
-                    return;
-                }
-                circle->setRadius(new_size1);
-                std::cout << "Size of circle changed." << std::endl;
-
-            // Rectangle case: Modify dimensions and check boundary
-            } else if (auto rectangle = dynamic_cast<Rectangle*>(shapes[i].get())) {
-                int width = new_size1;
-                int height = (new_size2 == -1) ? param2 : new_size2;
-                if (x < 0 || x + width > BOARD_WIDTH || y < 0 || y + height > BOARD_HEIGHT) {
-                    std::cout << "Error: Shape will go out of the board." << std::endl;
-                    return;
-                }
-                rectangle->setDimensions(width, height);
-                std::cout << "Size of rectangle changed." << std::endl;
-
-            // Triangle case: Modify height and check boundary
-            } else if (auto triangle = dynamic_cast<Triangle*>(shapes[i].get())) {
-                int height = new_size1;
-                int baseWidth = height * 2 - 1; // Typical triangular width calculation
-                if (x - baseWidth / 2 < 0 || x + baseWidth / 2 > BOARD_WIDTH || y < 0 || y + height > BOARD_HEIGHT) {
-                    std::cout << "Error: Shape will go out of the board." << std::endl;
-                    return;
-                }
-                triangle->setHeight(height);
-                std::cout << "Size of triangle changed." << std::endl;
-
-            // Square case: Modify side length and check boundary
-            } else if (auto line = dynamic_cast<Line*>(shapes[i].get())) {
-                // Check if the new coordinates will fit on the board
-                if (x < 0 || x + new_size1 > BOARD_WIDTH || y < 0 || y + new_size2 > BOARD_HEIGHT) {
-                    std::cout << "Error: Shape will go out of the board." << std::endl;
-                    return;
-                }
-                line->setDimensions(x, y, x + new_size1, y + new_size2);
-                std::cout << "Size of line changed." << std::endl;
+    // Look up the selected shape
+    if (PlacedShape* placed = shapes.get(selected)) {
+        // Get current position and parameters of the selected shape
+        auto [shapeType, x, y, param1, param2, fill, color] = parametersOf(placed->shape);
+        Rect oldBounds = boundsOf(placed->shape);
+        PlacedShape before = *placed;
 
-            } else {
-                std::cout << "Error: Unknown shape type." << std::endl;
+        // Circle case: Modify radius and check boundary
+        if (auto circle = std::get_if<Circle>(&placed->shape)) {
+            int radius = new_size1;
+            if (x - radius < 0 || x + radius > getWidth() || y - radius < 0 || y + radius > getHeight()) {
+                std::cout << "Error: Shape will go out of the board.\n";
+                return;
+            }
+            circle->setRadius(new_size1);
+            confirm() << "Size of circle changed.\n";
+
+        // Rectangle case: Modify dimensions and check boundary
+        } else if (auto rectangle = std::get_if<Rectangle>(&placed->shape)) {
+            int width = new_size1;
+            int height = (new_size2 == -1) ? param2 : new_size2;
+            if (x < 0 || x + width > getWidth() || y < 0 || y + height > getHeight()) {
+                std::cout << "Error: Shape will go out of the board.\n";
+                return;
             }
-            return; // Exit the function after modifying the shape
+            rectangle->setDimensions(width, height);
+            confirm() << "Size of rectangle changed.\n";
+
+        // Triangle case: Modify height and check boundary
+        } else if (auto triangle = std::get_if<Triangle>(&placed->shape)) {
+            int height = new_size1;
+            int baseWidth = height * 2 - 1; // Typical triangular width calculation
+            if (x - baseWidth / 2 < 0 || x + baseWidth / 2 > getWidth() || y < 0 || y + height > getHeight()) {
+                std::cout << "Error: Shape will go out of the board.\n";
+                return;
+            }
+            triangle->setHeight(height);
+            confirm() << "Size of triangle changed.\n";
+
+        // Square case: Modify side length and check boundary
+        } else if (auto line = std::get_if<Line>(&placed->shape)) {
+            // Check if the new coordinates will fit on the board
+            if (x < 0 || x + new_size1 > getWidth() || y < 0 || y + new_size2 > getHeight()) {
+                std::cout << "Error: Shape will go out of the board.\n";
+                return;
+            }
+            line->setDimensions(x, y, x + new_size1, y + new_size2);
+            confirm() << "Size of line changed.\n";
+
+        } else {
+            std::cout << "Error: Unknown shape type.\n";
         }
+
+        // Re-register the shape under its new bounds, keeping its draw order
+        tiles.remove(placed->drawOrder, oldBounds);
+        tiles.insert(placed->drawOrder, selected.index, boundsOf(placed->shape));
+        if (journaling()) {
+            payload().int32(selectedShapeID).int32(new_size1).int32(new_size2);
+            log(Journal::EDIT);
+        }
+        if (!historyMuted) {
+            recordChange("edit " + shapeType + " " + std::to_string(selectedShapeID), selectedShapeID, std::move(before), *placed);
+        }
+        return; // Exit the function after modifying the shape
     }
-    std::cout << "Error: Shape with ID " << selectedShapeID << " not found." << std::endl;
+    std::cout << "Error: Shape with ID " << selectedShapeID << " not found.\n";
 }
 
 
 };
 
-class CommandLine {
-    Board& board;
+// Reads the words and numbers of one command in place, without copying or
+// allocating, the way an istringstream would: numbers are parsed with
+// from_chars from wherever the previous read stopped, and once a read fails
+// every later one fails too. A number that is missing leaves its variable
+// as it was; one that does not parse sets it to 0.
+class CommandScanner {
+    std::string_view rest;
+    bool failed = false;
 
-public:
-    CommandLine(Board& b) : board(b) {}
+    void skipSpace() {
+        size_t i = 0;
+        while (i < rest.size() && std::isspace(static_cast<unsigned char>(rest[i]))) ++i;
+        rest.remove_prefix(i);
+    }
 
-    // Parse and execute a command
-    void executeCommand(const std::string& command) {
-        std::istringstream ss(command);
-        std::string action, shapeType, fill, color, filename;
-        int x, y, param1, param2 = 0;
+public:
+    explicit CommandScanner(std::string_view line) : rest(line) {}
+
+    // The next run of non-space characters, or an empty view
+    bool word(std::string_view& out) {
+        skipSpace();
+        if (failed || rest.empty()) {
+            failed = true;
+            out = {};
+            return false;
+        }
+        size_t end = 0;
+        while (end < rest.size() && !std::isspace(static_cast<unsigned char>(rest[end]))) ++end;
+        out = rest.substr(0, end);
+        rest.remove_prefix(end);
+        return true;
+    }
+
+    template <typename Integer>
+    bool number(Integer& out) {
+        skipSpace();
+        if (failed || rest.empty()) {
+            failed = true;
+            return false;
+        }
+        const char* begin = rest.data();
+        const char* end = begin + rest.size();
+        if (*begin == '+' && end - begin > 1 && std::isdigit(static_cast<unsigned char>(begin[1]))) ++begin;
+        auto [next, error] = std::from_chars(begin, end, out);
+        if (error == std::errc::result_out_of_range) {
+            out = *begin == '-' ? std::numeric_limits<Integer>::min() : std::numeric_limits<Integer>::max();
+        } else if (error != std::errc()) {
+            out = 0;
+        }
+        if (error != std::errc()) {
+            failed = true;
+            return false;
+        }
+        rest.remove_prefix(next - rest.data());
+        return true;
+    }
+};
 
-        ss >> action ;
+class CommandLine {
+    Board& board;
 
-        if (action == "save") {
-            ss >> filename;
-            board.save(filename);
-            return;
-        } else if (action == "load") {
-            ss >> filename;
-            board.load(filename);
-            return;
+    enum class Verb {
+        Unknown, Save, Load, Pick, Render, Add, New, Draw, Clear, List, Shapes,
+        Undo, Redo, History, Goto, Select, Remove, Paint, Move, Bench, Edit
+    };
+
+    // Switch on the length and first letters, then confirm with one compare
+    static Verb verbOf(std::string_view word) {
+        auto is = [word](std::string_view name, Verb verb) { return word == name ? verb : Verb::Unknown; };
+        switch (word.size()) {
+            case 3:
+                return word[0] == 'a' ? is("add", Verb::Add) : is("new", Verb::New);
+            case 4:
+                switch (word[0]) {
+                    case 'd': return is("draw", Verb::Draw);
+                    case 'e': return is("edit", Verb::Edit);
+                    case 'g': return is("goto", Verb::Goto);
+                    case 'l': return word[1] == 'o' ? is("load", Verb::Load) : is("list", Verb::List);
+                    case 'm': return is("move", Verb::Move);
+                    case 'p': return is("pick", Verb::Pick);
+                    case 'r': return is("redo", Verb::Redo);
+                    case 's': return is("save", Verb::Save);
+                    case 'u': return is("undo", Verb::Undo);
+                }
+                break;
+            case 5:
+                switch (word[0]) {
+                    case 'b': return is("bench", Verb::Bench);
+                    case 'c': return is("clear", Verb::Clear);
+                    case 'p': return is("paint", Verb::Paint);
+                }
+                break;
+            case 6:
+                if (word[0] == 'r') return word[2] == 'n' ? is("render", Verb::Render) : is("remove", Verb::Remove);
+                if (word[0] == 's') return word[1] == 'e' ? is("select", Verb::Select) : is("shapes", Verb::Shapes);
+                break;
+            case 7:
+                return is("history", Verb::History);
         }
+        return Verb::Unknown;
+    }
 
-        if (action == "add") {
-            ss >> shapeType;
-            ss >> fill >> color;
-
-            if (shapeType == "triangle" ) {
-                if (ss >> x >> y >> param1) {
-                    if (x >= 0 && x <= BOARD_WIDTH && y >= 0 && y <= BOARD_HEIGHT) {
-                        // x, y, height
-                        std::shared_ptr<Shape> triangle = std::make_shared<Triangle>(x, y, param1, fill, color);
-                        board.addTriangle(x, y, param1, fill, color);
-                        std::cout << "Triangle is succesfully added \n";
-                    }
-                    else {
-                        std::cout << "Error: Triangle's position is out of the board boundaries.\n";
-                    }
+    void add(CommandScanner& scanner) {
+        std::string_view shapeType, fill, color;
+        int x, y, param1, param2 = 0;
+        scanner.word(shapeType);
+        scanner.word(fill);
+        scanner.word(color);
+
+        if (shapeType == "triangle" ) {
+            if (scanner.number(x) && scanner.number(y) && scanner.number(param1)) {
+                if (x >= 0 && x <= board.getWidth() && y >= 0 && y <= board.getHeight()) {
+                    // x, y, height
+                    board.addTriangle(x, y, param1, fill, color);
+                    board.confirm() << "Triangle is succesfully added \n";
                 }
                 else {
-                    std::cout << "Error: Missing parameters for triangle. Expected x, y, height. Or figure out of the board\n";
+                    std::cout << "Error: Triangle's position is out of the board boundaries.\n";
                 }
-            } else if (shapeType == "circle") {
-                if (ss >> x >> y >> param1) {
-                    if (x - param1 >= 0 || x + param1 <= BOARD_WIDTH || y - param1 >= 0 || y + param1 <= BOARD_HEIGHT) {
+            }
+            else {
+                std::cout << "Error: Missing parameters for triangle. Expected x, y, height. Or figure out of the board\n";
+            }
+        } else if (shapeType == "circle") {
+            if (scanner.number(x) && scanner.number(y) && scanner.number(param1)) {
+                if (x - param1 >= 0 || x + param1 <= board.getWidth() || y - param1 >= 0 || y + param1 <= board.getHeight()) {
                     // x, y, radius
-                    std::shared_ptr<Shape> circle = std::make_shared<Circle>(x, y, param1, fill, color);
                     board.addCircle(x, y, param1, fill, color);
-                    std::cout << "Circle is succesfully added \n";
-                }
-                    else {
-                        std::cout << "Error: Circle's position or radius is out of the board boundaries.\n";
-                    }
+                    board.confirm() << "Circle is succesfully added \n";
                 }
                 else {
-                    std::cout << "Error: Missing parameters for circle. Expected x, y, radius.\n";
+                    std::cout << "Error: Circle's position or radius is out of the board boundaries.\n";
                 }
-            } else if (shapeType == "rectangle") {
-                if (ss >> x >> y >> param1 >> param2) {
-                    if (x >= 0 && x + param1 <= BOARD_WIDTH && y >= 0 && y + param2 <= BOARD_HEIGHT) {
-                        // x, y, height, weight
-                        std::shared_ptr<Shape> rectangle = std::make_shared<Rectangle>(x, y, param1, param2, fill, color);
-                        board.addRectangle(x, y, param1, param2, fill, color);
-                        std::cout << "Rectangle is succesfully added \n";
-                    }
-                    else {
-                        std::cout << "Error: Line's position or size is out of the board boundaries.\n";
-                    }
+            }
+            else {
+                std::cout << "Error: Missing parameters for circle. Expected x, y, radius.\n";
+            }
+        } else if (shapeType == "rectangle") {
+            if (scanner.number(x) && scanner.number(y) && scanner.number(param1) && scanner.number(param2)) {
+                if (x >= 0 && x + param1 <= board.getWidth() && y >= 0 && y + param2 <= board.getHeight()) {
+                    // x, y, height, weight
+                    board.addRectangle(x, y, param1, param2, fill, color);
+                    board.confirm() << "Rectangle is succesfully added \n";
                 }
                 else {
-                    std::cout << "Error: Missing parameters for rectangle. Expected x, y, height, weight.\n";
+                    std::cout << "Error: Line's position or size is out of the board boundaries.\n";
                 }
-            } else if (shapeType == "line") {
-                if (ss >> x >> y >> param1 >> param2) {
-                    // x1, y1, x2, y2
-                    if((x >= 0 && x <= BOARD_WIDTH && y >= 0 && y <= BOARD_HEIGHT) || (param1 >= 0 && param1 <= BOARD_WIDTH && param2 >= 0 && param2 <= BOARD_HEIGHT)) {
-                        std::shared_ptr<Shape> line = std::make_shared<Line>(x, y, param1, param2, fill, color);
-                        board.addLine(x, y, param1, param2, fill, color);
-                        std::cout << "Line is succesfully added \n";
-                    }
-                    else {
-                        std::cout << "Error: Line's start or end position is out of the board boundaries.\n";
-                    }
-
+            }
+            else {
+                std::cout << "Error: Missing parameters for rectangle. Expected x, y, height, weight.\n";
+            }
+        } else if (shapeType == "line") {
+            if (scanner.number(x) && scanner.number(y) && scanner.number(param1) && scanner.number(param2)) {
+                // x1, y1, x2, y2
+                if((x >= 0 && x <= board.getWidth() && y >= 0 && y <= board.getHeight()) || (param1 >= 0 && param1 <= board.getWidth() && param2 >= 0 && param2 <= board.getHeight())) {
+                    board.addLine(x, y, param1, param2, fill, color);
+                    board.confirm() << "Line is succesfully added \n";
                 }
                 else {
-                    std::cout << "Error: Missing parameters for line. Expected x1, y1, x2, y2.\n";
+                    std::cout << "Error: Line's start or end position is out of the board boundaries.\n";
                 }
+
             }
             else {
-                std::cout << "Unknown shape type \n";
-            }
-        } else if (action == "draw"){
-            board.drawBoard();
-        } else if (action == "clear"){
-            board.clear();
-            std::cout << "Board is succesfully cleared \n";
-        } else if (action == "list") {
-            board.showShapesList();
-            std::cout << "\n";
-        } else if (action == "shapes") {
-            Board::availableShapes();
-            std::cout << "\n";
-        } else if (action == "undo") {
-            board.undo();
-            std::cout << "\n";
-        } else if (action == "select") {
-            std::string selectInput;
-            std::getline(ss, selectInput);  // Capture the rest of the line as select input
-            board.select(selectInput);  // Assume this function is implemented
-            std::cout << "\n";
-        } else if (action == "remove") {
-            board.removeShape();
-            std::cout << "\n";
-        } else if (action == "paint") {
-            ss >> color;
-            if (color.empty()) {
-                std::cout << "Error: Missing color for paint command.\n";
-            } else {
-                board.paint(color);  // Call the paint method on the board
+                std::cout << "Error: Missing parameters for line. Expected x1, y1, x2, y2.\n";
             }
-        } else if (action == "move") {
-            int newX, newY;
-            ss >> newX >> newY;
-            board.move(newX, newY);
-            std::cout << "\n";
-        } else if (action == "edit") {
-            if (ss >> param1) {
-                if (ss >> param2) {
-                    board.edit(param1, param2); // Calls edit with two parameters
+        }
+        else {
+            std::cout << "Unknown shape type \n";
+        }
+    }
+
+    // select <id> or select <x> <y>
+    void select(CommandScanner& scanner) {
+        std::string_view first, second, extra;
+        int words = 0;
+        if (scanner.word(first)) ++words;
+        if (scanner.word(second)) ++words;
+        if (scanner.word(extra)) ++words;
+        int id, x, y;
+        if (words == 1 && CommandScanner(first).number(id)) {
+            board.selectByID(id);
+        } else if (words == 2 && CommandScanner(first).number(x) && CommandScanner(second).number(y)) {
+            board.selectByCoordinates(x, y);
+        } else {
+            std::cout << "Invalid input. Use 'select <id>' or 'select <x> <y>'.\n";
+        }
+    }
+
+public:
+    CommandLine(Board& b) : board(b) {}
+
+    // Parse and execute a command. Parsing works on the line in place; only
+    // commands naming a file copy the name.
+    void executeCommand(std::string_view command) {
+        CommandScanner scanner(command);
+        std::string_view action, filename, color;
+        int param1, param2 = 0;
+
+        scanner.word(action);
+        switch (verbOf(action)) {
+            case Verb::Save:
+                scanner.word(filename);
+                board.save(std::string(filename));
+                break;
+            case Verb::Load:
+                scanner.word(filename);
+                board.load(std::string(filename));
+                break;
+            case Verb::Pick:
+                scanner.word(filename);
+                board.pick(std::string(filename));
+                break;
+            case Verb::Render: {
+                // render <file> [scale]: write the frame as a PPM/PGM image
+                int scale = 1;
+                scanner.word(filename);
+                scanner.number(scale);
+                if (filename.empty()) {
+                    std::cerr << "Error: Missing file name for render.\n";
                 } else {
-                    board.edit(param1); // Calls edit with one parameter
+                    board.render(std::string(filename), scale);
                 }
-            } else {
-                std::cout << "Error: Missing parameters for edit command." << std::endl;
+                break;
             }
-        }
-        else {
-            std::cout << "Unknown command.\n";
+            case Verb::Add:
+                add(scanner);
+                break;
+            case Verb::New: {
+                int width, height;
+                if (!(scanner.number(width) && scanner.number(height))) {
+                    std::cout << "Error: Missing parameters for new. Expected width, height.\n";
+                } else if (!Board::isValidSize(width, height)) {
+                    std::cout << "Error: Board size must be between 1 and " << MAX_BOARD_SIZE << " in each dimension.\n";
+                } else {
+                    board.reset(width, height);
+                    board.confirm() << "New " << width << "x" << height << " board created \n";
+                }
+                break;
+            }
+            case Verb::Draw:
+                board.drawBoard();
+                break;
+            case Verb::Clear:
+                board.clear();
+                board.confirm() << "Board is succesfully cleared \n";
+                break;
+            case Verb::List:
+                board.showShapesList();
+                std::cout << "\n";
+                break;
+            case Verb::Shapes:
+                Board::availableShapes();
+                std::cout << "\n";
+                break;
+            case Verb::Undo:
+                board.undo();
+                board.confirm() << "\n";
+                break;
+            case Verb::Redo:
+                board.redo();
+                board.confirm() << "\n";
+                break;
+            case Verb::History:
+                board.showHistory();
+                break;
+            case Verb::Goto: {
+                long long position;
+                if (scanner.number(position) && position >= 0) {
+                    board.goTo(static_cast<size_t>(position));
+                } else {
+                    std::cout << "Error: Missing history position for goto.\n";
+                }
+                break;
+            }
+            case Verb::Select:
+                select(scanner);
+                board.confirm() << "\n";
+                break;
+            case Verb::Remove:
+                board.removeShape();
+                board.confirm() << "\n";
+                break;
+            case Verb::Paint:
+                scanner.word(color);
+                if (color.empty()) {
+                    std::cout << "Error: Missing color for paint command.\n";
+                } else {
+                    board.paint(color);  // Call the paint method on the board
+                }
+                break;
+            case Verb::Move: {
+                int newX = 0, newY = 0;
+                scanner.number(newX);
+                scanner.number(newY);
+                board.move(newX, newY);
+                board.confirm() << "\n";
+                break;
+            }
+            case Verb::Bench: {
+                // bench [width] [height] [iterations]: time the fill kernels
+                int width = 4096, height = 4096, iterations = 20;
+                scanner.number(width);
+                scanner.number(height);
+                scanner.number(iterations);
+                if (width <= 0 || height <= 0 || iterations <= 0) {
+                    std::cout << "Error: bench expects positive width, height and iterations.\n";
+                } else {
+                    FillKernel::benchmark(width, height, iterations);
+                }
+                break;
+            }
+            case Verb::Edit:
+                if (scanner.number(param1)) {
+                    if (scanner.number(param2)) {
+                        board.edit(param1, param2); // Calls edit with two parameters
+                    } else {
+                        board.edit(param1); // Calls edit with one parameter
+                    }
+                } else {
+                    std::cout << "Error: Missing parameters for edit command.\n";
+                }
+                break;
+            case Verb::Unknown:
+                std::cout << "Unknown command.\n";
+                break;
         }
     }
 };
 
-int main() {
-    Board board;
+int main(int argc, char* argv[]) {
+    int width = DEFAULT_BOARD_WIDTH;
+    int height = DEFAULT_BOARD_HEIGHT;
+    bool diff = false;
+    bool headless = false;
+    int renderInterval = -1; // Chosen once the input is known, unless given
+
+    // Optional startup size: --width <cells> --height <cells>
+    // --diff repaints only changed cells, on the terminal's alternate screen
+    // --render-interval <ms>: minimum time between frames, 0 to draw synchronously
+    // --headless: print nothing to stdout; frames are only produced by "render"
+    // --journal <file>: log every change to file, recovering the board it holds
+    // --history-budget <MiB>: memory the undo history may use
+    // --script <file>: run the commands in file instead of reading stdin
+    // --quiet: print only errors and the output of queries, not confirmations
+    std::string journalPath;
+    int historyBudget = DEFAULT_HISTORY_BUDGET_MB;
+    std::string scriptPath;
+    bool quiet = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if ((arg == "--width" || arg == "--height") && i + 1 < argc) {
+            (arg == "--width" ? width : height) = std::atoi(argv[++i]);
+        } else if (arg == "--diff") {
+            diff = true;
+        } else if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--render-interval" && i + 1 < argc) {
+            renderInterval = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--journal" && i + 1 < argc) {
+            journalPath = argv[++i];
+        } else if (arg == "--history-budget" && i + 1 < argc) {
+            historyBudget = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--script" && i + 1 < argc) {
+            scriptPath = argv[++i];
+        } else if (arg == "--quiet") {
+            quiet = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--width <cells>] [--height <cells>] [--diff] [--render-interval <ms>] [--headless]"
+                      << " [--journal <file>] [--history-budget <MiB>] [--script <file>] [--quiet]\n";
+            return 1;
+        }
+    }
+    if (!Board::isValidSize(width, height)) {
+        std::cerr << "Board size must be between 1 and " << MAX_BOARD_SIZE << " in each dimension.\n";
+        return 1;
+    }
+
+    // Commands typed at a terminal get a prompt, and their output is flushed
+    // before the next one is read. Scripts and piped commands run without
+    // prompts, and their output is only written out when the buffer fills
+    // or a frame is drawn.
+    std::ifstream script;
+    if (!scriptPath.empty()) {
+        script.open(scriptPath);
+        if (!script) {
+            std::cerr << "Cannot read script " << scriptPath << ".\n";
+            return 1;
+        }
+    }
+    std::istream& input = scriptPath.empty() ? std::cin : script;
+    bool interactive = scriptPath.empty() && isatty(STDIN_FILENO);
+    if (!interactive) {
+        std::ios::sync_with_stdio(false);
+        std::cin.tie(nullptr);
+    }
+    // Frames go through a render thread when commands are typed at a
+    // terminal; otherwise they are written in order with the rest of the output
+    if (renderInterval < 0) {
+        renderInterval = interactive && isatty(STDOUT_FILENO) ? DEFAULT_RENDER_INTERVAL_MS : 0;
+    }
+
+    Board board(width, height);
+    board.setHistoryBudget(static_cast<size_t>(historyBudget) << 20);
+    if (diff) {
+        if (TerminalRenderer::supported()) {
+            board.useTerminalRenderer();
+        } else {
+            std::cerr << "--diff needs a terminal; drawing full frames.\n";
+        }
+    }
+    if (quiet) {
+        board.useQuiet();
+    }
+    if (headless) {
+        board.useHeadless();
+        std::cout.rdbuf(nullptr); // Prompts and messages are dropped
+    } else if (renderInterval > 0) {
+        board.useRenderThread(std::chrono::milliseconds(renderInterval));
+    }
+    if (!journalPath.empty() && !board.useJournal(journalPath)) {
+        std::cerr << "Cannot use " << journalPath << " as a journal.\n";
+        return 1;
+    }
     CommandLine cli(board);
 
 
     std::string command;
     while (true) {
-        std::cout << "Enter command: ";
-        std::getline(std::cin, command);
+        if (interactive) std::cout << "Enter command: ";
+        if (input.rdbuf()->in_avail() <= 0) board.idle(); // Nothing buffered, so reading may block
+        if (!std::getline(input, command)) break; // End of input, e.g. a piped batch
 
         if (command == "exit") break;
 